@@ -4,7 +4,7 @@
 
 namespace eng
 {
-    class Added : public IComponent
+    class Added : public ITag
     {
     };
 }
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace eng
+{
+    namespace bits
+    {
+        // Return index of the lowest set bit. Undefined if 'value' is zero.
+        inline unsigned countTrailingZeros(uint64_t value)
+        {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+            unsigned long index;
+            _BitScanForward64(&index, value);
+            return static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+            // 64-bit scans are not available on 32-bit targets
+            unsigned long index;
+            if (_BitScanForward(&index, static_cast<uint32_t>(value)))
+            {
+                return static_cast<unsigned>(index);
+            }
+            _BitScanForward(&index, static_cast<uint32_t>(value >> 32));
+            return static_cast<unsigned>(index) + 32u;
+#else
+            return static_cast<unsigned>(__builtin_ctzll(value));
+#endif
+        }
+
+        // Return number of zero bits above the highest set bit. Undefined if 'value' is zero.
+        inline unsigned countLeadingZeros(uint64_t value)
+        {
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+            unsigned long index;
+            _BitScanReverse64(&index, value);
+            return 63u - static_cast<unsigned>(index);
+#elif defined(_MSC_VER)
+            unsigned long index;
+            if (_BitScanReverse(&index, static_cast<uint32_t>(value >> 32)))
+            {
+                return 31u - static_cast<unsigned>(index);
+            }
+            _BitScanReverse(&index, static_cast<uint32_t>(value));
+            return 63u - static_cast<unsigned>(index);
+#else
+            return static_cast<unsigned>(__builtin_clzll(value));
+#endif
+        }
+
+        // Return number of set bits.
+        inline unsigned popCount(uint64_t value)
+        {
+#ifdef _MSC_VER
+            // __popcnt64 requires the POPCNT instruction, which isn't
+            // guaranteed at runtime, so count the bits in parallel instead
+            value = value - ((value >> 1) & 0x5555555555555555ull);
+            value = (value & 0x3333333333333333ull) + ((value >> 2) & 0x3333333333333333ull);
+            value = (value + (value >> 4)) & 0x0f0f0f0f0f0f0f0full;
+            return static_cast<unsigned>((value * 0x0101010101010101ull) >> 56);
+#else
+            return static_cast<unsigned>(__builtin_popcountll(value));
+#endif
+        }
+    }
+}
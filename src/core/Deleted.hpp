@@ -4,7 +4,7 @@
 
 namespace eng
 {
-    class Deleted : public IComponent
+    class Deleted : public ITag
     {
     };
 }
\ No newline at end of file
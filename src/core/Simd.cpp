@@ -0,0 +1,332 @@
+#include <Precompiled.hpp>
+#include <core/Simd.hpp>
+
+#include <core/Bits.hpp>
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define ENG_SIMD_X64
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC allows intrinsics of any instruction set without compiler flags,
+// GCC and Clang need the target of each function using them
+#if defined(_MSC_VER) && !defined(__clang__)
+#define ENG_TARGET(isa)
+#else
+#define ENG_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace eng;
+using namespace eng::simd;
+
+namespace
+{
+    using BinaryKernel = void(*)(uint64_t*, const uint64_t*, size_t);
+    using CountKernel = size_t(*)(const uint64_t*, size_t);
+
+    struct AndOp
+    {
+        static uint64_t apply(uint64_t a, uint64_t b) { return a & b; }
+#ifdef ENG_SIMD_X64
+        ENG_TARGET("sse2") static __m128i apply(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+        ENG_TARGET("avx2") static __m256i apply(__m256i a, __m256i b) { return _mm256_and_si256(a, b); }
+#endif
+    };
+
+    struct OrOp
+    {
+        static uint64_t apply(uint64_t a, uint64_t b) { return a | b; }
+#ifdef ENG_SIMD_X64
+        ENG_TARGET("sse2") static __m128i apply(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+        ENG_TARGET("avx2") static __m256i apply(__m256i a, __m256i b) { return _mm256_or_si256(a, b); }
+#endif
+    };
+
+    struct XorOp
+    {
+        static uint64_t apply(uint64_t a, uint64_t b) { return a ^ b; }
+#ifdef ENG_SIMD_X64
+        ENG_TARGET("sse2") static __m128i apply(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+        ENG_TARGET("avx2") static __m256i apply(__m256i a, __m256i b) { return _mm256_xor_si256(a, b); }
+#endif
+    };
+
+    struct AndNotOp
+    {
+        static uint64_t apply(uint64_t a, uint64_t b) { return a & ~b; }
+#ifdef ENG_SIMD_X64
+        // Intrinsic negates its first operand
+        ENG_TARGET("sse2") static __m128i apply(__m128i a, __m128i b) { return _mm_andnot_si128(b, a); }
+        ENG_TARGET("avx2") static __m256i apply(__m256i a, __m256i b) { return _mm256_andnot_si256(b, a); }
+#endif
+    };
+
+    template <typename Op>
+    void scalarKernel(uint64_t* dst, const uint64_t* src, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            dst[i] = Op::apply(dst[i], src[i]);
+        }
+    }
+
+    size_t popCountScalar(const uint64_t* blocks, size_t count)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            total += bits::popCount(blocks[i]);
+        }
+        return total;
+    }
+
+#ifdef ENG_SIMD_X64
+    template <typename Op>
+    ENG_TARGET("sse2") void sse2Kernel(uint64_t* dst, const uint64_t* src, size_t count)
+    {
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2)
+        {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), Op::apply(a, b));
+        }
+        for (; i < count; ++i)
+        {
+            dst[i] = Op::apply(dst[i], src[i]);
+        }
+    }
+
+    template <typename Op>
+    ENG_TARGET("avx2") void avx2Kernel(uint64_t* dst, const uint64_t* src, size_t count)
+    {
+        size_t i = 0;
+        // Two registers per iteration to keep more loads in flight
+        for (; i + 8 <= count; i += 8)
+        {
+            __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i + 4));
+            __m256i b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 4));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), Op::apply(a0, b0));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 4), Op::apply(a1, b1));
+        }
+        for (; i + 4 <= count; i += 4)
+        {
+            __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), Op::apply(a, b));
+        }
+        for (; i < count; ++i)
+        {
+            dst[i] = Op::apply(dst[i], src[i]);
+        }
+    }
+
+    ENG_TARGET("popcnt") size_t popCountHardware(const uint64_t* blocks, size_t count)
+    {
+        size_t total = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            total += static_cast<size_t>(_mm_popcnt_u64(blocks[i]));
+        }
+        return total;
+    }
+
+    // Count bits of each nibble with a shuffle lookup table, and
+    // sum the byte counts into 64-bit lanes every few iterations.
+    ENG_TARGET("avx2,popcnt") size_t popCountAvx2(const uint64_t* blocks, size_t count)
+    {
+        const __m256i lookup = _mm256_setr_epi8(
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+        const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+
+        // Each iteration adds at most 8 to a byte counter
+        static constexpr size_t maxIterations = 255 / 8;
+
+        __m256i total = _mm256_setzero_si256();
+        const size_t vectorCount = count & ~size_t(3);
+
+        size_t i = 0;
+        while (i < vectorCount)
+        {
+            const size_t end = (std::min)(vectorCount, i + maxIterations * 4);
+
+            __m256i bytes = _mm256_setzero_si256();
+            for (; i < end; i += 4)
+            {
+                __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(blocks + i));
+                __m256i lo = _mm256_and_si256(v, lowNibbles);
+                __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibbles);
+                bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(
+                    _mm256_shuffle_epi8(lookup, lo),
+                    _mm256_shuffle_epi8(lookup, hi)));
+            }
+
+            total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+        }
+
+        alignas(32) uint64_t lanes[4];
+        _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), total);
+
+        size_t result = static_cast<size_t>(lanes[0] + lanes[1] + lanes[2] + lanes[3]);
+        for (; i < count; ++i)
+        {
+            result += static_cast<size_t>(_mm_popcnt_u64(blocks[i]));
+        }
+        return result;
+    }
+#endif
+
+    struct CpuFeatures
+    {
+        bool sse2 = false;
+        bool avx2 = false;
+        bool popcnt = false;
+    };
+
+    CpuFeatures detectCpuFeatures()
+    {
+        CpuFeatures features;
+
+#if defined(ENG_SIMD_X64) && defined(_MSC_VER) && !defined(__clang__)
+        int info[4];
+        __cpuid(info, 0);
+        const int maxLeaf = info[0];
+
+        __cpuid(info, 1);
+        features.sse2 = (info[3] & (1 << 26)) != 0;
+        features.popcnt = (info[2] & (1 << 23)) != 0;
+
+        // AVX registers must also be enabled by the OS
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+        {
+            __cpuidex(info, 7, 0);
+            features.avx2 = (info[1] & (1 << 5)) != 0;
+        }
+#elif defined(ENG_SIMD_X64)
+        __builtin_cpu_init();
+        features.sse2 = __builtin_cpu_supports("sse2") != 0;
+        features.avx2 = __builtin_cpu_supports("avx2") != 0;
+        features.popcnt = __builtin_cpu_supports("popcnt") != 0;
+#endif
+
+        return features;
+    }
+
+    const CpuFeatures& cpuFeatures()
+    {
+        static const CpuFeatures features = detectCpuFeatures();
+        return features;
+    }
+
+    struct Kernels
+    {
+        InstructionSet set;
+        BinaryKernel andBlocks;
+        BinaryKernel orBlocks;
+        BinaryKernel xorBlocks;
+        BinaryKernel andNotBlocks;
+        CountKernel popCount;
+    };
+
+    Kernels makeKernels(InstructionSet set)
+    {
+        Kernels kernels =
+        {
+            InstructionSet::Scalar,
+            scalarKernel<AndOp>,
+            scalarKernel<OrOp>,
+            scalarKernel<XorOp>,
+            scalarKernel<AndNotOp>,
+            popCountScalar
+        };
+
+#ifdef ENG_SIMD_X64
+        if (set == InstructionSet::AVX2)
+        {
+            kernels = { set, avx2Kernel<AndOp>, avx2Kernel<OrOp>, avx2Kernel<XorOp>, avx2Kernel<AndNotOp>, popCountScalar };
+            kernels.popCount = cpuFeatures().popcnt ? popCountAvx2 : popCountScalar;
+        }
+        else if (set == InstructionSet::SSE2)
+        {
+            kernels = { set, sse2Kernel<AndOp>, sse2Kernel<OrOp>, sse2Kernel<XorOp>, sse2Kernel<AndNotOp>, popCountScalar };
+            kernels.popCount = cpuFeatures().popcnt ? popCountHardware : popCountScalar;
+        }
+#else
+        (void) set;
+#endif
+
+        return kernels;
+    }
+
+    Kernels& kernels()
+    {
+        static Kernels kernels = makeKernels(supportedInstructionSet());
+        return kernels;
+    }
+}
+
+InstructionSet simd::instructionSet()
+{
+    return kernels().set;
+}
+
+InstructionSet simd::supportedInstructionSet()
+{
+    const CpuFeatures& features = cpuFeatures();
+
+    if (features.avx2)
+    {
+        return InstructionSet::AVX2;
+    }
+    if (features.sse2)
+    {
+        return InstructionSet::SSE2;
+    }
+    return InstructionSet::Scalar;
+}
+
+void simd::setInstructionSet(InstructionSet set)
+{
+    const InstructionSet supported = supportedInstructionSet();
+    if (static_cast<int>(set) > static_cast<int>(supported))
+    {
+        set = supported;
+    }
+
+    kernels() = makeKernels(set);
+}
+
+void simd::andBlocks(uint64_t* dst, const uint64_t* src, size_t count)
+{
+    kernels().andBlocks(dst, src, count);
+}
+
+void simd::orBlocks(uint64_t* dst, const uint64_t* src, size_t count)
+{
+    kernels().orBlocks(dst, src, count);
+}
+
+void simd::xorBlocks(uint64_t* dst, const uint64_t* src, size_t count)
+{
+    kernels().xorBlocks(dst, src, count);
+}
+
+void simd::andNotBlocks(uint64_t* dst, const uint64_t* src, size_t count)
+{
+    kernels().andNotBlocks(dst, src, count);
+}
+
+size_t simd::popCount(const uint64_t* blocks, size_t count)
+{
+    return kernels().popCount(blocks, count);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace eng
+{
+    // Bulk bitwise kernels over arrays of 64-bit blocks. The widest instruction
+    // set supported by the CPU is selected at runtime on first use, with a
+    // scalar fallback for other architectures.
+    namespace simd
+    {
+        enum class InstructionSet
+        {
+            Scalar,
+            SSE2,
+            AVX2
+        };
+
+        // Return instruction set used by the kernels.
+        InstructionSet instructionSet();
+        // Return widest instruction set supported by the CPU.
+        InstructionSet supportedInstructionSet();
+        // Select instruction set used by the kernels, clamped to what the CPU
+        // supports. Meant for tests and benchmarks, not thread-safe.
+        void setInstructionSet(InstructionSet set);
+
+        // dst[i] &= src[i]
+        void andBlocks(uint64_t* dst, const uint64_t* src, size_t count);
+        // dst[i] |= src[i]
+        void orBlocks(uint64_t* dst, const uint64_t* src, size_t count);
+        // dst[i] ^= src[i]
+        void xorBlocks(uint64_t* dst, const uint64_t* src, size_t count);
+        // dst[i] &= ~src[i]
+        void andNotBlocks(uint64_t* dst, const uint64_t* src, size_t count);
+
+        // Return total number of set bits in the blocks.
+        size_t popCount(const uint64_t* blocks, size_t count);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+namespace eng
+{
+    // Non-owning view over a contiguous range of elements.
+    template <typename T>
+    class Span
+    {
+    public:
+        Span() = default;
+        Span(T* data, size_t size) : m_data(data), m_size(size) {}
+
+        T* begin() const { return m_data; }
+        T* end() const { return m_data + m_size; }
+
+        T* data() const { return m_data; }
+        size_t size() const { return m_size; }
+        bool empty() const { return m_size == 0u; }
+
+        T& operator[](size_t index) const { return m_data[index]; }
+
+    private:
+        T* m_data = nullptr;
+        size_t m_size = 0u;
+    };
+}
@@ -0,0 +1,126 @@
+#include <Precompiled.hpp>
+#include <core/ThreadPool.hpp>
+
+#include <algorithm>
+
+using namespace eng;
+
+namespace
+{
+    // True while the thread executes a task of any pool
+    thread_local bool t_inTask = false;
+}
+
+ThreadPool::ThreadPool(unsigned workerCount)
+{
+    m_workers.reserve(workerCount);
+
+    for (unsigned i = 0; i < workerCount; ++i)
+    {
+        m_workers.emplace_back([this] { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_wake.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+unsigned ThreadPool::threadCount() const
+{
+    return static_cast<unsigned>(m_workers.size()) + 1u;
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+    if (m_workers.empty() || count <= 1u || t_inTask)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            task(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> loopLock(m_loopMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_task = &task;
+        m_taskCount = count;
+        m_nextTask = 0u;
+        m_busyWorkers = static_cast<unsigned>(m_workers.size());
+        m_loop++;
+    }
+
+    m_wake.notify_all();
+
+    runTasks();
+
+    // Workers may still be executing their last tasks
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_busyWorkers == 0u; });
+
+    m_task = nullptr;
+}
+
+ThreadPool& ThreadPool::shared()
+{
+#ifdef __EMSCRIPTEN__
+    static ThreadPool pool(0u);
+#else
+    static ThreadPool pool((std::max)(std::thread::hardware_concurrency(), 1u) - 1u);
+#endif
+    return pool;
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t loop = 0u;
+
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_loop != loop; });
+
+            if (m_stop)
+            {
+                return;
+            }
+
+            loop = m_loop;
+        }
+
+        runTasks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busyWorkers == 0u)
+        {
+            m_done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::runTasks()
+{
+    t_inTask = true;
+
+    for (size_t i = m_nextTask++; i < m_taskCount; i = m_nextTask++)
+    {
+        (*m_task)(i);
+    }
+
+    t_inTask = false;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <core/Traits.hpp>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace eng
+{
+    // Fixed set of worker threads which execute the tasks of a parallel
+    // loop together with the calling thread.
+    class ThreadPool : public trait::non_copyable_nor_movable
+    {
+    public:
+        // Create a pool with 'workerCount' threads in addition to the calling thread.
+        explicit ThreadPool(unsigned workerCount);
+        ~ThreadPool();
+
+        // Number of threads which execute tasks, including the calling thread.
+        unsigned threadCount() const;
+
+        // Execute 'task(i)' for each i in [0, count) and return once all tasks
+        // have finished. Loops started from within a task execute serially.
+        void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+        // Pool shared by the engine, with a worker for each additional hardware thread.
+        static ThreadPool& shared();
+
+    private:
+        void workerLoop();
+        // Execute tasks of the current loop until none remain.
+        void runTasks();
+
+    private:
+        std::vector<std::thread> m_workers;
+
+        // Serializes loops started from different threads
+        std::mutex m_loopMutex;
+
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+
+        // State of the current loop, published to workers under 'm_mutex'
+        const std::function<void(size_t)>* m_task = nullptr;
+        size_t m_taskCount = 0u;
+        std::atomic<size_t> m_nextTask{ 0u };
+        // Number of workers which haven't finished the current loop
+        unsigned m_busyWorkers = 0u;
+        uint64_t m_loop = 0u;
+        bool m_stop = false;
+    };
+}
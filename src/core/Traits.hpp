@@ -25,4 +25,18 @@ namespace trait
         non_copyable_nor_movable(non_copyable_nor_movable&&) = delete;
         non_copyable_nor_movable& operator=(non_copyable_nor_movable&&) = delete;
     };
+
+    // True if a function object of type F can be called with arguments of types Args.
+    template <typename F, typename... Args>
+    class is_callable
+    {
+        template <typename G>
+        static auto test(int) -> decltype(std::declval<G>()(std::declval<Args>()...), std::true_type());
+
+        template <typename>
+        static std::false_type test(...);
+
+    public:
+        static constexpr bool value = decltype(test<F>(0))::value;
+    };
 }
\ No newline at end of file
@@ -4,7 +4,7 @@
 
 namespace eng
 {
-    class Updated : public IComponent
+    class Updated : public ITag
     {
     };
 }
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include <Precompiled.hpp>
+#include <core/ecs/Archetype.hpp>
+
+using namespace eng;
+
+namespace
+{
+    size_t alignUp(size_t offset, size_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    // Compute column offsets for a chunk of given capacity 
+    // and return the total byte size of the chunk.
+    size_t layoutChunk(
+        std::vector<Archetype::Column>& columns,
+        uint32_t capacity)
+    {
+        size_t offset = sizeof(EntityId) * capacity;
+
+        for (auto& column : columns)
+        {
+            offset = alignUp(offset, column.info.alignment);
+            column.offset = offset;
+            offset += column.info.size * capacity;
+        }
+
+        return offset;
+    }
+}
+
+constexpr size_t Archetype::k_chunkSize;
+constexpr uint8_t Archetype::k_noColumn;
+constexpr uint32_t ArchetypeStorage::k_noArchetype;
+
+Archetype::Archetype(Signature signature, std::vector<Column> columns) :
+    m_signature(signature),
+    m_columns(std::move(columns))
+{
+    m_columnOfBit.fill(k_noColumn);
+    for (size_t i = 0; i < m_columns.size(); ++i)
+    {
+        m_columnOfBit[m_columns[i].bit] = static_cast<uint8_t>(i);
+    }
+
+    size_t rowSize = sizeof(EntityId);
+    for (auto& column : m_columns)
+    {
+        rowSize += column.info.size;
+    }
+
+    // Fit as many rows as possible into one chunk, accounting for alignment
+    uint32_t capacity = static_cast<uint32_t>(k_chunkSize / rowSize);
+    while (capacity > 1u && layoutChunk(m_columns, capacity) > k_chunkSize)
+    {
+        --capacity;
+    }
+
+    m_chunkCapacity = (std::max)(capacity, 1u);
+    m_chunkBytes = (std::max)(layoutChunk(m_columns, m_chunkCapacity), k_chunkSize);
+}
+
+bool Archetype::hasColumn(unsigned bit) const
+{
+    return m_signature.test(bit);
+}
+
+EntityId* Archetype::ids(size_t chunk) const
+{
+    return reinterpret_cast<EntityId*>(m_chunks[chunk].data.get());
+}
+
+void* Archetype::column(size_t chunk, unsigned bit) const
+{
+    uint8_t index = m_columnOfBit[bit];
+    if (index == k_noColumn)
+    {
+        return nullptr;
+    }
+
+    auto data = reinterpret_cast<uint8_t*>(m_chunks[chunk].data.get());
+    return data + m_columns[index].offset;
+}
+
+void* Archetype::component(size_t chunk, uint32_t row, unsigned bit) const
+{
+    uint8_t index = m_columnOfBit[bit];
+    assert(index != k_noColumn && "Archetype has no such column");
+
+    auto data = reinterpret_cast<uint8_t*>(m_chunks[chunk].data.get());
+    auto& column = m_columns[index];
+    return data + column.offset + column.info.size * row;
+}
+
+Archetype::Location Archetype::pushRow(EntityId id)
+{
+    if (m_chunks.empty() || m_chunks.back().count == m_chunkCapacity)
+    {
+        size_t blocks = alignUp(m_chunkBytes, sizeof(std::max_align_t)) / sizeof(std::max_align_t);
+
+        Chunk chunk;
+        chunk.data = std::make_unique<std::max_align_t[]>(blocks);
+        chunk.count = 0u;
+        m_chunks.emplace_back(std::move(chunk));
+    }
+
+    uint32_t chunk = static_cast<uint32_t>(m_chunks.size() - 1);
+    uint32_t row = m_chunks.back().count++;
+
+    ids(chunk)[row] = id;
+
+    return { chunk, row };
+}
+
+EntityId Archetype::eraseRow(Location location)
+{
+    for (auto& column : m_columns)
+    {
+        column.info.destroy(component(location.chunk, location.row, column.bit));
+    }
+
+    uint32_t lastChunk = static_cast<uint32_t>(m_chunks.size() - 1);
+    uint32_t lastRow = m_chunks.back().count - 1;
+
+    EntityId movedId = InvalidId;
+
+    if (location.chunk != lastChunk || location.row != lastRow)
+    {
+        // Move last row into the hole to keep chunks packed
+        for (auto& column : m_columns)
+        {
+            void* dst = component(location.chunk, location.row, column.bit);
+            void* src = component(lastChunk, lastRow, column.bit);
+
+            column.info.moveConstruct(dst, src);
+            column.info.destroy(src);
+        }
+
+        movedId = ids(lastChunk)[lastRow];
+        ids(location.chunk)[location.row] = movedId;
+    }
+
+    if (--m_chunks.back().count == 0u)
+    {
+        m_chunks.pop_back();
+    }
+
+    return movedId;
+}
+
+void ArchetypeStorage::registerColumn(unsigned bit, ComponentInfo info)
+{
+    assert(bit < k_maxComponents && "Component bit out of range");
+
+    m_columnInfos[bit] = info;
+}
+
+void ArchetypeStorage::assign(EntityId id, unsigned bit, void* component)
+{
+    const uint32_t index = entityIndex(id);
+    if (index >= m_records.size())
+    {
+        m_records.resize(static_cast<size_t>(index) + 1);
+    }
+
+    Record source = m_records[index];
+
+    if (source.archetype != k_noArchetype)
+    {
+        auto& archetype = *m_archetypes[source.archetype];
+        if (archetype.hasColumn(bit))
+        {
+            // Entity already has the component, overwrite it in place
+            m_columnInfos[bit].moveAssign(
+                archetype.component(source.location.chunk, source.location.row, bit),
+                component);
+            return;
+        }
+    }
+
+    Signature signature;
+    if (source.archetype != k_noArchetype)
+    {
+        signature = m_archetypes[source.archetype]->signature();
+    }
+    signature.set(bit);
+
+    uint32_t targetIndex = findOrCreateArchetype(signature);
+    auto& target = *m_archetypes[targetIndex];
+    auto location = target.pushRow(id);
+
+    if (source.archetype != k_noArchetype)
+    {
+        // Move existing components from the source archetype
+        auto& archetype = *m_archetypes[source.archetype];
+        for (auto& column : archetype.columns())
+        {
+            column.info.moveConstruct(
+                target.component(location.chunk, location.row, column.bit),
+                archetype.component(source.location.chunk, source.location.row, column.bit));
+        }
+
+        eraseRow(source.archetype, source.location);
+    }
+
+    m_columnInfos[bit].moveConstruct(
+        target.component(location.chunk, location.row, bit),
+        component);
+
+    m_records[index] = { targetIndex, location };
+    m_structuralVersion++;
+}
+
+void ArchetypeStorage::remove(EntityId id, unsigned bit)
+{
+    const Record* current = record(id);
+    if (!current || !m_archetypes[current->archetype]->hasColumn(bit))
+    {
+        return;
+    }
+
+    Record source = *current;
+    auto& archetype = *m_archetypes[source.archetype];
+
+    Signature signature = archetype.signature();
+    signature.reset(bit);
+
+    if (signature.none())
+    {
+        eraseRow(source.archetype, source.location);
+        m_records[entityIndex(id)] = {};
+        m_structuralVersion++;
+        return;
+    }
+
+    uint32_t targetIndex = findOrCreateArchetype(signature);
+    auto& target = *m_archetypes[targetIndex];
+    auto location = target.pushRow(id);
+
+    for (auto& column : target.columns())
+    {
+        column.info.moveConstruct(
+            target.component(location.chunk, location.row, column.bit),
+            archetype.component(source.location.chunk, source.location.row, column.bit));
+    }
+
+    eraseRow(source.archetype, source.location);
+
+    m_records[entityIndex(id)] = { targetIndex, location };
+    m_structuralVersion++;
+}
+
+void ArchetypeStorage::destroy(EntityId id)
+{
+    const Record* current = record(id);
+    if (!current)
+    {
+        return;
+    }
+
+    eraseRow(current->archetype, current->location);
+    m_records[entityIndex(id)] = {};
+    m_structuralVersion++;
+}
+
+bool ArchetypeStorage::check(EntityId id, unsigned bit) const
+{
+    const Record* current = record(id);
+    return current && m_archetypes[current->archetype]->hasColumn(bit);
+}
+
+void* ArchetypeStorage::get(EntityId id, unsigned bit) const
+{
+    const Record* current = record(id);
+    if (!current)
+    {
+        return nullptr;
+    }
+
+    auto& archetype = *m_archetypes[current->archetype];
+    if (!archetype.hasColumn(bit))
+    {
+        return nullptr;
+    }
+
+    return archetype.component(current->location.chunk, current->location.row, bit);
+}
+
+EntityId ArchetypeStorage::entity(uint32_t index) const
+{
+    const Record* current = record(index);
+    if (!current)
+    {
+        return InvalidId;
+    }
+
+    return m_archetypes[current->archetype]->ids(current->location.chunk)[current->location.row];
+}
+
+uint32_t ArchetypeStorage::findOrCreateArchetype(const Signature& signature)
+{
+    auto it = m_archetypeLookup.find(signature);
+    if (it != m_archetypeLookup.end())
+    {
+        return it->second;
+    }
+
+    std::vector<Archetype::Column> columns;
+    for (unsigned bit = 0; bit < k_maxComponents; ++bit)
+    {
+        if (signature.test(bit))
+        {
+            assert(m_columnInfos[bit].size > 0u && "Column not registered");
+            columns.push_back({ bit, m_columnInfos[bit], 0u });
+        }
+    }
+
+    uint32_t index = static_cast<uint32_t>(m_archetypes.size());
+    m_archetypes.emplace_back(std::make_unique<Archetype>(signature, std::move(columns)));
+    m_archetypeLookup[signature] = index;
+
+    return index;
+}
+
+void ArchetypeStorage::eraseRow(uint32_t archetype, Archetype::Location location)
+{
+    EntityId movedId = m_archetypes[archetype]->eraseRow(location);
+    if (movedId != InvalidId)
+    {
+        m_records[entityIndex(movedId)].location = location;
+    }
+}
+
+const ArchetypeStorage::Record* ArchetypeStorage::record(EntityId id) const
+{
+    const uint32_t index = entityIndex(id);
+    if (index >= m_records.size() || m_records[index].archetype == k_noArchetype)
+    {
+        return nullptr;
+    }
+
+    return &m_records[index];
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <core/Core.hpp>
+#include <core/ecs/EntityId.hpp>
+#include <core/ecs/Signature.hpp>
+
+#include <array>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace eng
+{
+    // Type-erased operations for storing components in raw memory.
+    struct ComponentInfo
+    {
+        size_t size;
+        size_t alignment;
+        // Move construct 'src' into uninitialized memory at 'dst'.
+        void (*moveConstruct)(void* dst, void* src);
+        // Move assign 'src' into constructed 'dst'.
+        void (*moveAssign)(void* dst, void* src);
+        void (*destroy)(void* ptr);
+
+        template <typename Component>
+        static ComponentInfo of();
+    };
+
+    // Storage for all entities which share the same component signature.
+    // Entities are stored in fixed-size chunks with one structure-of-arrays
+    // column per component, so iterating over an archetype is a linear walk.
+    class Archetype : public trait::non_copyable
+    {
+    public:
+        // Target byte size of a single chunk.
+        static constexpr size_t k_chunkSize = 16 * 1024;
+
+        struct Column
+        {
+            unsigned bit;
+            ComponentInfo info;
+            // Byte offset of column data within a chunk
+            size_t offset;
+        };
+
+    public:
+        Archetype(Signature signature, std::vector<Column> columns);
+
+        const Signature& signature() const { return m_signature; }
+
+        // Maximum number of entities per chunk.
+        uint32_t chunkCapacity() const { return m_chunkCapacity; }
+        size_t chunkCount() const { return m_chunks.size(); }
+        uint32_t entityCount(size_t chunk) const { return m_chunks[chunk].count; }
+
+        bool hasColumn(unsigned bit) const;
+
+        // Entity ids stored in a chunk.
+        EntityId* ids(size_t chunk) const;
+        // Component data of a column in a chunk, or nullptr if no such column.
+        void* column(size_t chunk, unsigned bit) const;
+        // Component data of a column for a row in a chunk.
+        void* component(size_t chunk, uint32_t row, unsigned bit) const;
+
+        const std::vector<Column>& columns() const { return m_columns; }
+
+    private:
+        friend class ArchetypeStorage;
+
+        struct Chunk
+        {
+            std::unique_ptr<std::max_align_t[]> data;
+            uint32_t count;
+        };
+
+        struct Location
+        {
+            uint32_t chunk;
+            uint32_t row;
+        };
+
+        // Reserve an uninitialized row at the end of the archetype.
+        Location pushRow(EntityId id);
+        // Destroy the components at a row and fill the hole with the last row.
+        // Return the id of the entity which was moved into the row, if any.
+        EntityId eraseRow(Location location);
+
+    private:
+        static constexpr uint8_t k_noColumn = 0xff;
+
+        Signature m_signature;
+        std::vector<Column> m_columns;
+        // Column index for each signature bit
+        std::array<uint8_t, k_maxComponents> m_columnOfBit;
+
+        uint32_t m_chunkCapacity = 0u;
+        size_t m_chunkBytes = 0u;
+        std::vector<Chunk> m_chunks;
+    };
+
+    // Archetype based component storage backend for a database. Groups entities
+    // by their component signature, moving an entity between archetypes when
+    // a component is assigned to or removed from it.
+    class ArchetypeStorage : public trait::non_copyable
+    {
+    public:
+        // Register a component column for a signature bit.
+        void registerColumn(unsigned bit, ComponentInfo info);
+
+        // Move component into the entity, adding the column if necessary.
+        void assign(EntityId id, unsigned bit, void* component);
+        void remove(EntityId id, unsigned bit);
+        // Remove all components of the entity.
+        void destroy(EntityId id);
+
+        bool check(EntityId id, unsigned bit) const;
+        void* get(EntityId id, unsigned bit) const;
+        // Return id of the entity stored at an entity index, or InvalidId if none.
+        EntityId entity(uint32_t index) const;
+
+        // Execute function for each non-empty chunk of every archetype which
+        // contains all the columns in 'mask'.
+        template <typename F>
+        void forEachChunk(const Signature& mask, F&& f) const;
+
+        // Incremented whenever an entity moves between archetypes.
+        uint64_t structuralVersion() const { return m_structuralVersion; }
+        size_t archetypeCount() const { return m_archetypes.size(); }
+
+    private:
+        static constexpr uint32_t k_noArchetype = std::numeric_limits<uint32_t>::max();
+
+        struct Record
+        {
+            uint32_t archetype = k_noArchetype;
+            Archetype::Location location = {};
+        };
+
+        uint32_t findOrCreateArchetype(const Signature& signature);
+        void eraseRow(uint32_t archetype, Archetype::Location location);
+        const Record* record(EntityId id) const;
+
+    private:
+        std::array<ComponentInfo, k_maxComponents> m_columnInfos = {};
+
+        std::vector<std::unique_ptr<Archetype>> m_archetypes;
+        std::unordered_map<Signature, uint32_t> m_archetypeLookup;
+
+        // Location of each entity, indexed by entity index
+        std::vector<Record> m_records;
+
+        uint64_t m_structuralVersion = 0u;
+    };
+
+    template <typename Component>
+    inline ComponentInfo ComponentInfo::of()
+    {
+        static_assert(alignof(Component) <= alignof(std::max_align_t),
+            "Over-aligned components are not supported by archetype storage");
+
+        ComponentInfo info;
+        info.size = sizeof(Component);
+        info.alignment = alignof(Component);
+        info.moveConstruct = [](void* dst, void* src)
+        {
+            new (dst) Component(std::move(*static_cast<Component*>(src)));
+        };
+        info.moveAssign = [](void* dst, void* src)
+        {
+            *static_cast<Component*>(dst) = std::move(*static_cast<Component*>(src));
+        };
+        info.destroy = [](void* ptr)
+        {
+            static_cast<Component*>(ptr)->~Component();
+        };
+        return info;
+    }
+
+    template <typename F>
+    inline void ArchetypeStorage::forEachChunk(const Signature& mask, F&& f) const
+    {
+        for (auto& archetype : m_archetypes)
+        {
+            if ((archetype->signature() & mask) != mask)
+            {
+                continue;
+            }
+
+            for (size_t chunk = 0; chunk < archetype->chunkCount(); ++chunk)
+            {
+                if (archetype->entityCount(chunk) > 0u)
+                {
+                    f(*archetype, chunk);
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#include <Precompiled.hpp>
+#include <core/ecs/ComponentType.hpp>
+
+#include <atomic>
+
+using namespace eng;
+
+ComponentTypeId detail::nextComponentTypeId()
+{
+    static std::atomic<ComponentTypeId> s_nextId(0u);
+    return s_nextId++;
+}
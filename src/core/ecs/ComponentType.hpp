@@ -0,0 +1,22 @@
+#pragma once
+
+#include <core/Core.hpp>
+
+namespace eng
+{
+    // Sequential id of a component type, assigned on first use. Ids are dense
+    // and unique within the process, so they can index flat arrays directly.
+    using ComponentTypeId = uint32_t;
+
+    namespace detail
+    {
+        ComponentTypeId nextComponentTypeId();
+    }
+
+    template <typename Component>
+    inline ComponentTypeId componentTypeId()
+    {
+        static const ComponentTypeId id = detail::nextComponentTypeId();
+        return id;
+    }
+}
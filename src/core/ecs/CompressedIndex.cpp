@@ -0,0 +1,858 @@
+#include <Precompiled.hpp>
+#include <core/ecs/CompressedIndex.hpp>
+
+#include <core/Bits.hpp>
+
+#include <algorithm>
+
+using namespace eng;
+
+namespace
+{
+    constexpr uint32_t k_chunkSize = 65536u;
+
+    uint16_t highBits(uint64_t id)
+    {
+        return static_cast<uint16_t>(id >> 16);
+    }
+
+    uint16_t lowBits(uint64_t id)
+    {
+        return static_cast<uint16_t>(id & 0xffffu);
+    }
+
+    // Return the first set bit at or after 'from', or k_chunkSize if there is none.
+    uint32_t nextSetBit(const std::vector<uint64_t>& words, uint32_t from)
+    {
+        size_t word = from / 64u;
+        if (word >= words.size())
+        {
+            return k_chunkSize;
+        }
+
+        uint64_t bits = words[word] & (~uint64_t(0) << (from % 64u));
+        while (bits == 0u)
+        {
+            if (++word >= words.size())
+            {
+                return k_chunkSize;
+            }
+            bits = words[word];
+        }
+
+        return static_cast<uint32_t>(word * 64u + bits::countTrailingZeros(bits));
+    }
+
+    // Set bits [from, to] of a bitmap.
+    void setRange(std::vector<uint64_t>& words, uint32_t from, uint32_t to)
+    {
+        const size_t first = from / 64u;
+        const size_t last = to / 64u;
+
+        for (size_t word = first; word <= last; ++word)
+        {
+            unsigned lo = word == first ? from % 64u : 0u;
+            unsigned hi = word == last ? to % 64u : 63u;
+
+            words[word] |= (~uint64_t(0) >> (63u - hi)) & (~uint64_t(0) << lo);
+        }
+    }
+
+    uint32_t popCount(const std::vector<uint64_t>& words)
+    {
+        uint32_t count = 0;
+        for (auto word : words)
+        {
+            count += bits::popCount(word);
+        }
+        return count;
+    }
+}
+
+constexpr uint32_t CompressedIndex::k_arrayMaxSize;
+constexpr uint32_t CompressedIndex::k_bitmapWords;
+constexpr size_t CompressedIndex::k_noContainer;
+
+void CompressedIndex::insert(EntityId id)
+{
+    Container& container = findOrCreateContainer(highBits(id));
+    const uint16_t value = lowBits(id);
+
+    if (container.type == ContainerType::Run)
+    {
+        if (contains(container, value))
+        {
+            return;
+        }
+        normalize(container);
+    }
+
+    if (container.type == ContainerType::Array)
+    {
+        auto it = std::lower_bound(container.values.begin(), container.values.end(), value);
+        if (it != container.values.end() && *it == value)
+        {
+            return;
+        }
+
+        container.values.insert(it, value);
+
+        if (++container.cardinality > k_arrayMaxSize)
+        {
+            toBitmap(container);
+        }
+    }
+    else
+    {
+        uint64_t& word = container.bitmap[value / 64u];
+        const uint64_t bit = uint64_t(1) << (value % 64u);
+
+        if ((word & bit) == 0u)
+        {
+            word |= bit;
+            ++container.cardinality;
+        }
+    }
+}
+
+void CompressedIndex::insertRange(EntityId first, uint32_t count)
+{
+    if (count == 0u)
+    {
+        return;
+    }
+
+    uint64_t begin = first;
+    const uint64_t last = uint64_t(first) + count - 1;
+
+    assert(last <= std::numeric_limits<EntityId>::max() && "Id range out of bounds");
+
+    while (begin <= last)
+    {
+        const uint16_t key = highBits(begin);
+        const uint64_t chunkBegin = uint64_t(key) << 16;
+        const uint32_t from = lowBits(begin);
+        const uint32_t to = static_cast<uint32_t>((std::min)(last - chunkBegin, uint64_t(k_chunkSize - 1)));
+
+        size_t index = findContainer(key);
+        if (index == k_noContainer)
+        {
+            // Empty chunk, the range is stored as a single run
+            Container& container = findOrCreateContainer(key);
+            container.type = ContainerType::Run;
+            container.values = { static_cast<uint16_t>(from), static_cast<uint16_t>(to - from) };
+            container.cardinality = to - from + 1;
+        }
+        else
+        {
+            Container& container = m_containers[index];
+            toBitmap(container);
+            setRange(container.bitmap, from, to);
+            container.cardinality = popCount(container.bitmap);
+        }
+
+        begin = chunkBegin + k_chunkSize;
+    }
+}
+
+void CompressedIndex::erase(EntityId id)
+{
+    const size_t index = findContainer(highBits(id));
+    if (index == k_noContainer)
+    {
+        return;
+    }
+
+    Container& container = m_containers[index];
+    const uint16_t value = lowBits(id);
+
+    if (!contains(container, value))
+    {
+        return;
+    }
+
+    if (container.type == ContainerType::Run)
+    {
+        normalize(container);
+    }
+
+    if (container.type == ContainerType::Array)
+    {
+        container.values.erase(
+            std::lower_bound(container.values.begin(), container.values.end(), value));
+    }
+    else
+    {
+        container.bitmap[value / 64u] &= ~(uint64_t(1) << (value % 64u));
+    }
+
+    if (--container.cardinality == 0u)
+    {
+        eraseContainer(index);
+    }
+    else if (container.type == ContainerType::Bitmap &&
+        container.cardinality <= k_arrayMaxSize / 2)
+    {
+        // Convert well below the limit, so that inserting and erasing
+        // around the limit doesn't convert back and forth
+        toArray(container);
+    }
+}
+
+void CompressedIndex::clear()
+{
+    m_keys.clear();
+    m_containers.clear();
+}
+
+bool CompressedIndex::check(EntityId id) const
+{
+    const size_t index = findContainer(highBits(id));
+
+    return index != k_noContainer && contains(m_containers[index], lowBits(id));
+}
+
+size_t CompressedIndex::size() const
+{
+    size_t count = 0;
+    for (auto& container : m_containers)
+    {
+        count += container.cardinality;
+    }
+    return count;
+}
+
+bool CompressedIndex::empty() const
+{
+    // Containers are erased as soon as they become empty
+    return m_keys.empty();
+}
+
+void CompressedIndex::optimize()
+{
+    for (auto& container : m_containers)
+    {
+        const size_t runBytes = runCount(container) * 2 * sizeof(uint16_t);
+        const size_t arrayBytes = container.cardinality <= k_arrayMaxSize ?
+            container.cardinality * sizeof(uint16_t) :
+            std::numeric_limits<size_t>::max();
+        const size_t bitmapBytes = k_bitmapWords * sizeof(uint64_t);
+
+        if (runBytes < arrayBytes && runBytes < bitmapBytes)
+        {
+            toRun(container);
+        }
+        else
+        {
+            normalize(container);
+        }
+
+        container.values.shrink_to_fit();
+        container.bitmap.shrink_to_fit();
+    }
+
+    m_keys.shrink_to_fit();
+    m_containers.shrink_to_fit();
+}
+
+size_t CompressedIndex::memoryUsage() const
+{
+    size_t bytes =
+        m_keys.capacity() * sizeof(uint16_t) +
+        m_containers.capacity() * sizeof(Container);
+
+    for (auto& container : m_containers)
+    {
+        bytes += container.values.capacity() * sizeof(uint16_t);
+        bytes += container.bitmap.capacity() * sizeof(uint64_t);
+    }
+
+    return bytes;
+}
+
+CompressedIndex& CompressedIndex::operator|=(const CompressedIndex& other)
+{
+    for (size_t i = 0; i < other.m_keys.size(); ++i)
+    {
+        const Container& source = other.m_containers[i];
+
+        const size_t index = findContainer(other.m_keys[i]);
+        if (index == k_noContainer)
+        {
+            findOrCreateContainer(other.m_keys[i]) = source;
+            continue;
+        }
+
+        Container& target = m_containers[index];
+
+        if (target.type == ContainerType::Array && source.type == ContainerType::Array)
+        {
+            std::vector<uint16_t> values;
+            values.reserve(target.values.size() + source.values.size());
+
+            std::set_union(
+                target.values.begin(), target.values.end(),
+                source.values.begin(), source.values.end(),
+                std::back_inserter(values));
+
+            target.values.swap(values);
+            target.cardinality = static_cast<uint32_t>(target.values.size());
+        }
+        else
+        {
+            toBitmap(target);
+            setBits(source, target.bitmap);
+            target.cardinality = popCount(target.bitmap);
+        }
+
+        normalize(target);
+    }
+
+    return *this;
+}
+
+CompressedIndex& CompressedIndex::operator&=(const CompressedIndex& other)
+{
+    if (&other == this)
+    {
+        return *this;
+    }
+
+    size_t kept = 0;
+
+    for (size_t i = 0; i < m_keys.size(); ++i)
+    {
+        const size_t index = other.findContainer(m_keys[i]);
+        if (index == k_noContainer)
+        {
+            // Chunk is empty in other, drop the whole container
+            continue;
+        }
+
+        Container& target = m_containers[i];
+        const Container& source = other.m_containers[index];
+
+        if (target.type == ContainerType::Array)
+        {
+            // Only our values can remain, probe each of them from other
+            target.values.erase(
+                std::remove_if(target.values.begin(), target.values.end(),
+                    [&](uint16_t value) { return !contains(source, value); }),
+                target.values.end());
+
+            target.cardinality = static_cast<uint32_t>(target.values.size());
+        }
+        else if (source.type == ContainerType::Array)
+        {
+            // Only values of other can remain, probe each of them from us
+            std::vector<uint16_t> values;
+            values.reserve(source.values.size());
+
+            for (auto value : source.values)
+            {
+                if (contains(target, value))
+                {
+                    values.emplace_back(value);
+                }
+            }
+
+            target.type = ContainerType::Array;
+            target.values.swap(values);
+            target.bitmap.clear();
+            target.bitmap.shrink_to_fit();
+            target.cardinality = static_cast<uint32_t>(target.values.size());
+        }
+        else
+        {
+            toBitmap(target);
+
+            if (source.type == ContainerType::Bitmap)
+            {
+                for (size_t word = 0; word < k_bitmapWords; ++word)
+                {
+                    target.bitmap[word] &= source.bitmap[word];
+                }
+            }
+            else
+            {
+                std::vector<uint64_t> words(k_bitmapWords, uint64_t(0));
+                setBits(source, words);
+
+                for (size_t word = 0; word < k_bitmapWords; ++word)
+                {
+                    target.bitmap[word] &= words[word];
+                }
+            }
+
+            target.cardinality = popCount(target.bitmap);
+            normalize(target);
+        }
+
+        if (target.cardinality > 0u)
+        {
+            if (kept != i)
+            {
+                m_keys[kept] = m_keys[i];
+                m_containers[kept] = std::move(target);
+            }
+            ++kept;
+        }
+    }
+
+    m_keys.resize(kept);
+    m_containers.resize(kept);
+
+    return *this;
+}
+
+CompressedIndex& CompressedIndex::operator^=(const CompressedIndex& other)
+{
+    if (&other == this)
+    {
+        clear();
+        return *this;
+    }
+
+    for (size_t i = 0; i < other.m_keys.size(); ++i)
+    {
+        const Container& source = other.m_containers[i];
+
+        const size_t index = findContainer(other.m_keys[i]);
+        if (index == k_noContainer)
+        {
+            findOrCreateContainer(other.m_keys[i]) = source;
+            continue;
+        }
+
+        Container& target = m_containers[index];
+
+        if (target.type == ContainerType::Array && source.type == ContainerType::Array)
+        {
+            std::vector<uint16_t> values;
+            values.reserve(target.values.size() + source.values.size());
+
+            std::set_symmetric_difference(
+                target.values.begin(), target.values.end(),
+                source.values.begin(), source.values.end(),
+                std::back_inserter(values));
+
+            target.values.swap(values);
+            target.cardinality = static_cast<uint32_t>(target.values.size());
+        }
+        else
+        {
+            toBitmap(target);
+
+            if (source.type == ContainerType::Bitmap)
+            {
+                for (size_t word = 0; word < k_bitmapWords; ++word)
+                {
+                    target.bitmap[word] ^= source.bitmap[word];
+                }
+            }
+            else
+            {
+                std::vector<uint64_t> words(k_bitmapWords, uint64_t(0));
+                setBits(source, words);
+
+                for (size_t word = 0; word < k_bitmapWords; ++word)
+                {
+                    target.bitmap[word] ^= words[word];
+                }
+            }
+
+            target.cardinality = popCount(target.bitmap);
+        }
+
+        if (target.cardinality == 0u)
+        {
+            eraseContainer(index);
+        }
+        else
+        {
+            normalize(target);
+        }
+    }
+
+    return *this;
+}
+
+CompressedIndex::Iterator CompressedIndex::begin() const
+{
+    return Iterator(*this, 0u);
+}
+
+CompressedIndex::Iterator CompressedIndex::end() const
+{
+    return Iterator(*this, m_containers.size());
+}
+
+size_t CompressedIndex::findContainer(uint16_t key) const
+{
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+    if (it != m_keys.end() && *it == key)
+    {
+        return static_cast<size_t>(it - m_keys.begin());
+    }
+    return k_noContainer;
+}
+
+CompressedIndex::Container& CompressedIndex::findOrCreateContainer(uint16_t key)
+{
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), key);
+    const size_t index = static_cast<size_t>(it - m_keys.begin());
+
+    if (it == m_keys.end() || *it != key)
+    {
+        m_keys.insert(it, key);
+        m_containers.insert(m_containers.begin() + index, Container());
+    }
+
+    return m_containers[index];
+}
+
+void CompressedIndex::eraseContainer(size_t index)
+{
+    m_keys.erase(m_keys.begin() + index);
+    m_containers.erase(m_containers.begin() + index);
+}
+
+bool CompressedIndex::contains(const Container& container, uint16_t value)
+{
+    switch (container.type)
+    {
+        case ContainerType::Array:
+            return std::binary_search(container.values.begin(), container.values.end(), value);
+
+        case ContainerType::Bitmap:
+            return (container.bitmap[value / 64u] >> (value % 64u)) & 1u;
+
+        case ContainerType::Run:
+        {
+            // Find the last run which starts at or before the value
+            size_t lo = 0;
+            size_t hi = container.values.size() / 2;
+            while (lo < hi)
+            {
+                size_t mid = (lo + hi) / 2;
+                if (container.values[mid * 2] <= value)
+                {
+                    lo = mid + 1;
+                }
+                else
+                {
+                    hi = mid;
+                }
+            }
+
+            if (lo == 0)
+            {
+                return false;
+            }
+
+            const size_t run = (lo - 1) * 2;
+            return uint32_t(value) <= uint32_t(container.values[run]) + container.values[run + 1];
+        }
+    }
+
+    return false;
+}
+
+void CompressedIndex::setBits(const Container& container, std::vector<uint64_t>& words)
+{
+    assert(words.size() == k_bitmapWords && "Invalid bitmap size");
+
+    switch (container.type)
+    {
+        case ContainerType::Array:
+            for (auto value : container.values)
+            {
+                words[value / 64u] |= uint64_t(1) << (value % 64u);
+            }
+            break;
+
+        case ContainerType::Bitmap:
+            for (size_t word = 0; word < k_bitmapWords; ++word)
+            {
+                words[word] |= container.bitmap[word];
+            }
+            break;
+
+        case ContainerType::Run:
+            for (size_t run = 0; run < container.values.size(); run += 2)
+            {
+                const uint32_t start = container.values[run];
+                setRange(words, start, start + container.values[run + 1]);
+            }
+            break;
+    }
+}
+
+void CompressedIndex::toBitmap(Container& container)
+{
+    if (container.type == ContainerType::Bitmap)
+    {
+        return;
+    }
+
+    std::vector<uint64_t> words(k_bitmapWords, uint64_t(0));
+    setBits(container, words);
+
+    container.type = ContainerType::Bitmap;
+    container.bitmap.swap(words);
+    container.values.clear();
+    container.values.shrink_to_fit();
+}
+
+void CompressedIndex::toArray(Container& container)
+{
+    if (container.type == ContainerType::Array)
+    {
+        return;
+    }
+
+    std::vector<uint16_t> values;
+    values.reserve(container.cardinality);
+
+    if (container.type == ContainerType::Bitmap)
+    {
+        for (size_t word = 0; word < k_bitmapWords; ++word)
+        {
+            uint64_t bits = container.bitmap[word];
+            while (bits != 0u)
+            {
+                values.emplace_back(static_cast<uint16_t>(word * 64u + bits::countTrailingZeros(bits)));
+                bits &= bits - 1u;
+            }
+        }
+    }
+    else
+    {
+        for (size_t run = 0; run < container.values.size(); run += 2)
+        {
+            const uint32_t start = container.values[run];
+            const uint32_t end = start + container.values[run + 1];
+
+            for (uint32_t value = start; value <= end; ++value)
+            {
+                values.emplace_back(static_cast<uint16_t>(value));
+            }
+        }
+    }
+
+    container.type = ContainerType::Array;
+    container.values.swap(values);
+    container.bitmap.clear();
+    container.bitmap.shrink_to_fit();
+}
+
+void CompressedIndex::toRun(Container& container)
+{
+    if (container.type == ContainerType::Run)
+    {
+        return;
+    }
+
+    std::vector<uint16_t> runs;
+    runs.reserve(runCount(container) * 2);
+
+    auto append = [&](uint32_t value)
+    {
+        const size_t count = runs.size();
+        if (count > 0 && uint32_t(runs[count - 2]) + runs[count - 1] + 1 == value)
+        {
+            ++runs[count - 1];
+        }
+        else
+        {
+            runs.emplace_back(static_cast<uint16_t>(value));
+            runs.emplace_back(uint16_t(0));
+        }
+    };
+
+    if (container.type == ContainerType::Array)
+    {
+        for (auto value : container.values)
+        {
+            append(value);
+        }
+    }
+    else
+    {
+        for (uint32_t value = nextSetBit(container.bitmap, 0u);
+            value < k_chunkSize;
+            value = nextSetBit(container.bitmap, value + 1))
+        {
+            append(value);
+        }
+    }
+
+    container.type = ContainerType::Run;
+    container.values.swap(runs);
+    container.bitmap.clear();
+    container.bitmap.shrink_to_fit();
+}
+
+void CompressedIndex::normalize(Container& container)
+{
+    if (container.cardinality <= k_arrayMaxSize)
+    {
+        toArray(container);
+    }
+    else
+    {
+        toBitmap(container);
+    }
+}
+
+size_t CompressedIndex::runCount(const Container& container)
+{
+    switch (container.type)
+    {
+        case ContainerType::Array:
+        {
+            size_t runs = container.values.empty() ? 0u : 1u;
+            for (size_t i = 1; i < container.values.size(); ++i)
+            {
+                if (container.values[i] != container.values[i - 1] + 1)
+                {
+                    ++runs;
+                }
+            }
+            return runs;
+        }
+
+        case ContainerType::Bitmap:
+        {
+            // A run starts at each set bit whose preceding bit is clear
+            size_t runs = 0;
+            uint64_t carry = 0u;
+            for (auto word : container.bitmap)
+            {
+                runs += bits::popCount(word & ~((word << 1) | carry));
+                carry = word >> 63;
+            }
+            return runs;
+        }
+
+        case ContainerType::Run:
+            return container.values.size() / 2;
+    }
+
+    return 0;
+}
+
+CompressedIndex::Iterator::Iterator(const CompressedIndex& container, size_t chunk) :
+    m_container(&container),
+    m_chunk(chunk)
+{
+    seekChunk();
+}
+
+void CompressedIndex::Iterator::seekChunk()
+{
+    m_cursor = 0u;
+    m_value = 0u;
+
+    if (m_chunk >= m_container->m_containers.size())
+    {
+        return;
+    }
+
+    const Container& container = m_container->m_containers[m_chunk];
+
+    // Containers are never empty, so each has a first value
+    m_value = container.type == ContainerType::Bitmap ?
+        nextSetBit(container.bitmap, 0u) :
+        container.values[0];
+}
+
+CompressedIndex::Iterator& CompressedIndex::Iterator::operator++()
+{
+    const Container& container = m_container->m_containers[m_chunk];
+
+    switch (container.type)
+    {
+        case ContainerType::Array:
+            if (++m_cursor < container.values.size())
+            {
+                m_value = container.values[m_cursor];
+                return *this;
+            }
+            break;
+
+        case ContainerType::Bitmap:
+            m_value = nextSetBit(container.bitmap, m_value + 1);
+            if (m_value < k_chunkSize)
+            {
+                return *this;
+            }
+            break;
+
+        case ContainerType::Run:
+        {
+            const uint32_t runEnd =
+                uint32_t(container.values[m_cursor * 2]) + container.values[m_cursor * 2 + 1];
+
+            if (m_value < runEnd)
+            {
+                ++m_value;
+                return *this;
+            }
+            if (++m_cursor < container.values.size() / 2)
+            {
+                m_value = container.values[m_cursor * 2];
+                return *this;
+            }
+            break;
+        }
+    }
+
+    ++m_chunk;
+    seekChunk();
+
+    return *this;
+}
+
+CompressedIndex::Iterator CompressedIndex::Iterator::operator++(int)
+{
+    Iterator it = *this;
+    ++(*this);
+    return it;
+}
+
+bool CompressedIndex::Iterator::operator==(Iterator other) const
+{
+    return m_chunk == other.m_chunk && m_value == other.m_value;
+}
+
+bool CompressedIndex::Iterator::operator!=(Iterator other) const
+{
+    return !(*this == other);
+}
+
+CompressedIndex::Iterator::reference CompressedIndex::Iterator::operator*() const
+{
+    return (static_cast<EntityId>(m_container->m_keys[m_chunk]) << 16) | m_value;
+}
+
+eng::CompressedIndex eng::operator|(const CompressedIndex& lhs, const CompressedIndex& rhs)
+{
+    CompressedIndex out = lhs;
+    out |= rhs;
+    return out;
+}
+
+eng::CompressedIndex eng::operator&(const CompressedIndex& lhs, const CompressedIndex& rhs)
+{
+    CompressedIndex out = lhs;
+    out &= rhs;
+    return out;
+}
+
+eng::CompressedIndex eng::operator^(const CompressedIndex& lhs, const CompressedIndex& rhs)
+{
+    CompressedIndex out = lhs;
+    out ^= rhs;
+    return out;
+}
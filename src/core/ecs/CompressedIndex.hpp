@@ -0,0 +1,134 @@
+#pragma once
+
+#include <core/ecs/EntityId.hpp>
+
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+namespace eng
+{
+    // Compressed set of entity ids in the style of roaring bitmaps. Ids are split
+    // into 64K-id chunks by their high 16 bits, and each non-empty chunk is stored
+    // in a container which suits its contents:
+    // * array:  sorted list of up to 4096 low 16-bit values
+    // * bitmap: 65536 bits
+    // * run:    sorted list of runs of consecutive values
+    // Empty chunks take no memory, so the index stays small for sparse sets
+    // spread over a huge id range.
+    class CompressedIndex
+    {
+    public:
+        void insert(EntityId id);
+        // Insert 'count' consecutive ids starting from 'first'.
+        void insertRange(EntityId first, uint32_t count);
+        void erase(EntityId id);
+        void clear();
+
+        bool check(EntityId id) const;
+
+        size_t size() const;
+        bool empty() const;
+
+        // Convert each container into its smallest representation. Runs are
+        // only produced here and by insertRange, other operations keep arrays
+        // and bitmaps.
+        void optimize();
+        // Return number of bytes allocated by the index.
+        size_t memoryUsage() const;
+
+        CompressedIndex& operator|=(const CompressedIndex& other);
+        CompressedIndex& operator&=(const CompressedIndex& other);
+        CompressedIndex& operator^=(const CompressedIndex& other);
+
+        friend CompressedIndex operator|(const CompressedIndex& lhs, const CompressedIndex& rhs);
+        friend CompressedIndex operator&(const CompressedIndex& lhs, const CompressedIndex& rhs);
+        friend CompressedIndex operator^(const CompressedIndex& lhs, const CompressedIndex& rhs);
+
+    public:
+        // Iterates over ids in ascending order. Invalidated by any modification.
+        class Iterator : public std::iterator<
+            std::input_iterator_tag,
+            EntityId,
+            uint32_t,
+            const EntityId*,
+            EntityId>
+        {
+        public:
+            Iterator(const CompressedIndex& container, size_t chunk);
+
+            Iterator& operator++();
+            Iterator operator++(int);
+
+            bool operator==(Iterator other) const;
+            bool operator!=(Iterator other) const;
+
+            reference operator*() const;
+
+        private:
+            // Move to the first value of the current chunk.
+            void seekChunk();
+
+        private:
+            const CompressedIndex* m_container;
+            // Index of current container.
+            size_t m_chunk;
+            // Position within an array container, or run index within a run container.
+            size_t m_cursor = 0u;
+            // Current low 16 bits of the id.
+            uint32_t m_value = 0u;
+        };
+
+    public:
+        Iterator begin() const;
+        Iterator end() const;
+
+    private:
+        enum class ContainerType : uint8_t
+        {
+            Array,
+            Bitmap,
+            Run
+        };
+
+        struct Container
+        {
+            ContainerType type = ContainerType::Array;
+            uint32_t cardinality = 0u;
+            // Array: sorted values. Run: pairs of run start and run length - 1.
+            std::vector<uint16_t> values;
+            // Bitmap: one bit for each value in the chunk.
+            std::vector<uint64_t> bitmap;
+        };
+
+        static constexpr uint32_t k_arrayMaxSize = 4096u;
+        static constexpr uint32_t k_bitmapWords = 65536u / 64u;
+        static constexpr size_t k_noContainer = std::numeric_limits<size_t>::max();
+
+        size_t findContainer(uint16_t key) const;
+        Container& findOrCreateContainer(uint16_t key);
+        void eraseContainer(size_t index);
+
+        static bool contains(const Container& container, uint16_t value);
+        // Set bits of all values in the container to 'words'.
+        static void setBits(const Container& container, std::vector<uint64_t>& words);
+        static void toBitmap(Container& container);
+        static void toArray(Container& container);
+        static void toRun(Container& container);
+        // Convert bitmap and run containers to an array or a bitmap based on cardinality.
+        static void normalize(Container& container);
+        // Return number of runs of consecutive values in the container.
+        static size_t runCount(const Container& container);
+
+    private:
+        // High 16 bits of each non-empty chunk, in ascending order
+        std::vector<uint16_t> m_keys;
+        // Container of each chunk in 'm_keys'
+        std::vector<Container> m_containers;
+    };
+
+    CompressedIndex operator|(const CompressedIndex& lhs, const CompressedIndex& rhs);
+    CompressedIndex operator&(const CompressedIndex& lhs, const CompressedIndex& rhs);
+    CompressedIndex operator^(const CompressedIndex& lhs, const CompressedIndex& rhs);
+}
@@ -3,13 +3,24 @@
 
 using namespace eng;
 
-Database::Database() :
+Database::Database(StorageBackend backend) :
+    m_backend(backend),
+    m_archetypes(backend == StorageBackend::Archetypes ? 
+        std::make_unique<ArchetypeStorage>() : 
+        nullptr),
+    m_generations(std::make_unique<std::vector<uint16_t>>(1u, uint16_t(0u))),
+    m_changeTick(std::make_unique<uint32_t>(1u)),
     m_added(createTable<Added>()),
     m_updated(createTable<Updated>()),
     m_deleted(createTable<Deleted>())
 {
 }
 
+void Database::advanceChangeTick()
+{
+    (*m_changeTick)++;
+}
+
 void Database::clearTags()
 {
     m_added.clear();
@@ -21,16 +32,111 @@ void Database::purgeDeleted()
 {
     for (auto&& id : m_deleted.ids())
     { 
-        for (auto& kv : m_tables)
+        if (!valid(id))
+        {
+            continue;
+        }
+
+        if (m_archetypes)
+        {
+            // Release all components at once instead of moving 
+            // the entity through an archetype for each removal
+            m_archetypes->destroy(id);
+        }
+
+        for (auto& table : m_tables)
+        {
+            if (table)
+            {
+                table->remove(id);
+            }
+        }
+
+        // Invalidate existing handles to the entity and recycle its slot.
+        // A slot whose generation saturates is retired, since wrapping
+        // around would validate the oldest handles to the slot again.
+        const uint32_t index = entityIndex(id);
+        if (++(*m_generations)[index] < k_maxEntityGeneration)
+        {
+            m_freeIndices.push_back(index);
+        }
+    }
+}
+
+void Database::sync()
+{
+    for (auto& table : m_tables)
+    {
+        if (table)
+        {
+            table->syncSignatures(m_signatures);
+        }
+    }
+}
+
+CompactionStats Database::compact(double budgetMs)
+{
+    CompactionStats stats;
+    Timer timer = Timer::start();
+
+    for (size_t i = 0; i < m_tables.size(); ++i)
+    {
+        if (timer.elapsed() >= budgetMs)
+        {
+            break;
+        }
+
+        size_t tableIndex = m_nextCompactedTable;
+        m_nextCompactedTable = (m_nextCompactedTable + 1) % m_tables.size();
+
+        auto& table = m_tables[tableIndex];
+        if (!table)
+        {
+            continue;
+        }
+
+        auto tableStats = table->compact(timer, budgetMs);
+        stats.moved += tableStats.moved;
+        stats.remaining += tableStats.remaining;
+
+        if (tableStats.remaining > 0u)
         {
-            kv.second->remove(id);
+            // Out of budget, continue from this table on the next pass
+            m_nextCompactedTable = tableIndex;
+            break;
         }
     }
+
+    return stats;
 }
 
 EntityId Database::createEntity()
 {
-    auto id = m_nextEntityId;
-    m_nextEntityId++;
-    return id;
+    uint32_t index;
+
+    if (!m_freeIndices.empty())
+    {
+        index = m_freeIndices.front();
+        m_freeIndices.pop_front();
+    }
+    else
+    {
+        index = static_cast<uint32_t>(m_generations->size());
+        assert(index < k_entityIndexMask && "Too many entities");
+
+        m_generations->push_back(0u);
+    }
+
+    return makeEntityId(index, (*m_generations)[index]);
+}
+
+EntityRange Database::createEntities(uint32_t count)
+{
+    uint32_t first = static_cast<uint32_t>(m_generations->size());
+    assert(static_cast<uint64_t>(first) + count <= k_entityIndexMask && "Too many entities");
+
+    // New slots start from generation zero, so their ids are consecutive
+    m_generations->resize(static_cast<size_t>(first) + count, 0u);
+
+    return EntityRange(makeEntityId(first, 0u), count);
 }
@@ -1,18 +1,30 @@
 #pragma once
 
 #include <core/Core.hpp>
+#include <core/ecs/Archetype.hpp>
+#include <core/ecs/ComponentType.hpp>
 #include <core/ecs/EntityId.hpp>
 #include <core/ecs/IComponent.hpp>
 #include <core/ecs/Table.hpp>
 
 namespace eng
 {
+    // Component storage layout of a database.
+    enum class StorageBackend
+    {
+        // Each table stores its components in a packed array.
+        Tables,
+        // Entities are grouped by their component signature into 
+        // fixed-size chunks, with one array per component type.
+        Archetypes
+    };
+
     // Central storage of the Entity Component System.
     // Stores entities and their components.
     class Database : public trait::non_copyable
     {
     public:
-        Database();
+        explicit Database(StorageBackend backend = StorageBackend::Tables);
         Database(Database&&) = default;
         Database& operator=(Database&&) = default;
 
@@ -25,7 +37,36 @@ namespace eng
         template <typename Component>
         const TableRef<Component> table() const;
 
+        // Create a new entity, recycling the slot of a purged entity if available.
         EntityId createEntity();
+        // Create a batch of entities with consecutive ids. Always uses new slots,
+        // since recycled slots would break the range.
+        EntityRange createEntities(uint32_t count);
+        // Return true if the id refers to an entity which has not been purged.
+        bool valid(EntityId id) const;
+        // Return id of the entity currently occupying a slot.
+        EntityId entity(uint32_t index) const;
+
+        StorageBackend backend() const { return m_backend; }
+
+        // Return the current change tick. Tables stamp components with the tick
+        // in which they were assigned or marked written, see Query::changedSince.
+        // Ticks start from 1, so that 0 means never.
+        uint32_t changeTick() const { return *m_changeTick; }
+        // Advance to the next change tick, after each system update, so that
+        // a system can tell apart writes made before and after it executed.
+        void advanceChangeTick();
+
+        // Apply all structural changes of the database tables to entity signatures.
+        // Must be called at a sync point, when no system is modifying the tables.
+        void sync();
+
+        // Return signature describing the components an entity had at the last sync point.
+        const Signature& signature(EntityId id) const;
+
+        // Incrementally reorder the components of all tables into entity order,
+        // within a time budget. Tables are visited round-robin across calls.
+        CompactionStats compact(double budgetMs);
 
         // Remove all Added, Updated, and Deleted components from entities.
         void clearTags();
@@ -33,22 +74,36 @@ namespace eng
         void purgeDeleted();
 
     private:
-        using TableId = size_t;
-
-        template <typename Component>
-        TableId tableId() const;
-
-    private:
-        // Container for all tables created from this database.
-        std::unordered_map<TableId, std::unique_ptr<ITable>> m_tables;
+        // Container for all tables created from this database, indexed by
+        // component type id. Null for component types without a table.
+        std::vector<std::unique_ptr<ITable>> m_tables;
+        // Number of created tables, used to assign signature bits.
+        unsigned m_tableCount = 0u;
+        // Table from which the next compaction pass starts.
+        size_t m_nextCompactedTable = 0u;
+
+        StorageBackend m_backend;
+        // Shared component storage of all tables when using the archetype backend.
+        std::unique_ptr<ArchetypeStorage> m_archetypes;
+
+        // Component signature of each entity, indexed by entity id.
+        std::vector<Signature> m_signatures;
+        Signature m_emptySignature;
+
+        // Generation of each entity slot, indexed by entity index. Slot 0 is
+        // reserved so that no entity is ever assigned InvalidId. Allocated on
+        // the heap so that tag tables can resolve ids after a database move.
+        std::unique_ptr<std::vector<uint16_t>> m_generations;
+        // Current change tick, allocated on the heap for the same reason.
+        std::unique_ptr<uint32_t> m_changeTick;
 
         TableRef<Added>   m_added;
         TableRef<Updated> m_updated;
         TableRef<Deleted> m_deleted;
 
-        // TODO: consider changing this to 'mutable' to allow 
-        // entity creation from const database reference.
-        EntityId m_nextEntityId = 1u;
+        // Slots of purged entities, reused in the order they were freed to
+        // spread generation increments over all free slots.
+        std::deque<uint32_t> m_freeIndices;
     };
 
     template <typename Component>
@@ -57,11 +112,28 @@ namespace eng
         static_assert(std::is_base_of<IComponent, Component>::value,
             "Cannot create Table for other type than a component");
 
-        static TableId id = tableId<Component>();
+        const ComponentTypeId id = componentTypeId<Component>();
+
+        if (id >= m_tables.size())
+        {
+            m_tables.resize(static_cast<size_t>(id) + 1);
+        }
+
+        assert(!m_tables[id] && "Table already created");
+        assert(m_tableCount < k_maxComponents && "Too many tables");
 
-        assert(!m_tables.count(id) && "Table already created");
+        // Signature bits are assigned per database, so that a database only
+        // uses as many bits as it has tables regardless of the type id
+        unsigned componentBit = m_tableCount++;
+        if (m_archetypes && !std::is_base_of<ITag, Component>::value)
+        {
+            m_archetypes->registerColumn(componentBit, ComponentInfo::of<Component>());
+        }
 
-        m_tables[id] = std::make_unique<Table<Component>>();
+        auto newTable = std::make_unique<Table<Component>>();
+        newTable->attach(componentBit, m_archetypes.get(), m_generations.get(), m_changeTick.get());
+
+        m_tables[id] = std::move(newTable);
 
         return table<Component>();
     }
@@ -69,26 +141,42 @@ namespace eng
     template <typename Component>
     inline TableRef<Component> Database::table()
     {
-        static TableId id = tableId<Component>();
+        const ComponentTypeId id = componentTypeId<Component>();
 
-        assert(m_tables.count(id) && "No such table");
+        assert(id < m_tables.size() && m_tables[id] && "No such table");
 
-        return static_cast<TableRef<Component>>(*m_tables.at(id));
+        return static_cast<TableRef<Component>>(*m_tables[id]);
     }
 
     template <typename Component>
     inline const TableRef<Component> Database::table() const
     {
-        static TableId id = tableId<Component>();
+        const ComponentTypeId id = componentTypeId<Component>();
 
-        assert(m_tables.count(id) && "No such table");
+        assert(id < m_tables.size() && m_tables[id] && "No such table");
 
-        return static_cast<const TableRef<Component>>(*m_tables.at(id));
+        return static_cast<const TableRef<Component>>(*m_tables[id]);
     }
 
-    template <typename Component>
-    inline Database::TableId Database::tableId() const
+    inline const Signature& Database::signature(EntityId id) const
+    {
+        const uint32_t index = entityIndex(id);
+        return index < m_signatures.size() ? m_signatures[index] : m_emptySignature;
+    }
+
+    inline bool Database::valid(EntityId id) const
     {
-        return typeid(Component).hash_code();
+        const uint32_t index = entityIndex(id);
+        // Retired slots have a saturated generation, which no handle is given
+        return index != 0u && index < m_generations->size() &&
+            entityGeneration(id) < k_maxEntityGeneration &&
+            (*m_generations)[index] == entityGeneration(id);
+    }
+
+    inline EntityId Database::entity(uint32_t index) const
+    {
+        assert(index < m_generations->size() && "Entity index out of range");
+
+        return makeEntityId(index, (*m_generations)[index]);
     }
 }
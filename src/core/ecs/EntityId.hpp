@@ -2,7 +2,70 @@
 
 namespace eng
 {
-    using EntityId = uint32_t;
+    // Handle to an entity. The low bits hold the index of the entity slot in
+    // the database and the high bits the generation of the slot, which is
+    // incremented each time the slot is recycled for a new entity. A slot is
+    // retired instead of recycled once its generation is saturated, so that
+    // stale handles never validate again.
+    using EntityId = uint64_t;
 
     constexpr EntityId InvalidId = 0u;
+
+    constexpr unsigned k_entityIndexBits = 32u;
+    constexpr EntityId k_entityIndexMask = (EntityId(1) << k_entityIndexBits) - 1u;
+
+    constexpr unsigned k_entityGenerationBits = 16u;
+    constexpr uint32_t k_maxEntityGeneration = (1u << k_entityGenerationBits) - 1u;
+
+    constexpr uint32_t entityIndex(EntityId id)
+    {
+        return static_cast<uint32_t>(id & k_entityIndexMask);
+    }
+
+    constexpr uint32_t entityGeneration(EntityId id)
+    {
+        return static_cast<uint32_t>(id >> k_entityIndexBits);
+    }
+
+    constexpr EntityId makeEntityId(uint32_t index, uint32_t generation)
+    {
+        return (EntityId(generation) << k_entityIndexBits) | index;
+    }
+
+    // Range of consecutive entity ids.
+    class EntityRange
+    {
+    public:
+        class Iterator
+        {
+        public:
+            explicit Iterator(EntityId id) : m_id(id) {}
+
+            EntityId operator*() const { return m_id; }
+            Iterator& operator++() { ++m_id; return *this; }
+
+            bool operator==(Iterator other) const { return m_id == other.m_id; }
+            bool operator!=(Iterator other) const { return m_id != other.m_id; }
+
+        private:
+            EntityId m_id;
+        };
+
+    public:
+        EntityRange() = default;
+        EntityRange(EntityId first, uint32_t count) : m_first(first), m_count(count) {}
+
+        Iterator begin() const { return Iterator(m_first); }
+        Iterator end() const { return Iterator(m_first + m_count); }
+
+        EntityId first() const { return m_first; }
+        uint32_t size() const { return m_count; }
+        bool empty() const { return m_count == 0u; }
+
+        EntityId operator[](size_t index) const { return m_first + static_cast<EntityId>(index); }
+
+    private:
+        EntityId m_first = InvalidId;
+        uint32_t m_count = 0u;
+    };
 }
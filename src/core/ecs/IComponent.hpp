@@ -1,10 +1,24 @@
 #pragma once
 
+#include <core/ecs/SparseIndex.hpp>
+#include <core/ecs/SparseSet.hpp>
+
 namespace eng
 {
     class IComponent
     {
     public:
         virtual ~IComponent() {}
+
+        // Container which indexes the entities of the component's table.
+        // Components may redeclare this as SparseSet, which suits tables with
+        // few entities spread over a large id range and frequent churn.
+        using Index = SparseIndex;
+    };
+
+    // Base class for tag components, which carry no data. 
+    // Tables of tags only track which entities have the tag.
+    class ITag : public IComponent
+    {
     };
-}
\ No newline at end of file
+}
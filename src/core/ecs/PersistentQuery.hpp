@@ -0,0 +1,65 @@
+#pragma once
+
+#include <core/ecs/Query.hpp>
+
+#include <memory>
+
+namespace eng
+{
+    // Query which is declared once, typically as a system member, and built
+    // when its tables exist, e.g. in System::onRegistered. The tables and
+    // signatures of the query are resolved when it's built, so that each
+    // execution only plans and iterates the matching entities. The template
+    // arguments are the filter terms of the built query, in the same order:
+    //
+    //     PersistentQuery<ConstTableRef<Selected>, TableRef<Transform>> m_selected;
+    //
+    //     m_selected = query()
+    //         .hasComponent<Selected>()
+    //         .hasComponent<Transform>(m_transformTable);
+    //
+    //     m_selected->execute([&](EntityId, const Selected&, Transform&) { ... });
+    template <typename... Tables>
+    class PersistentQuery : public trait::non_copyable
+    {
+    public:
+        PersistentQuery() = default;
+        PersistentQuery(PersistentQuery&&) = default;
+        PersistentQuery& operator=(PersistentQuery&&) = default;
+
+        // Keep a built query, replacing any previous one.
+        PersistentQuery& operator=(Query<Tables...>&& query);
+
+        // Return true if a query has been built.
+        bool built() const { return m_query != nullptr; }
+
+        Query<Tables...>& operator*();
+        Query<Tables...>* operator->();
+
+    private:
+        // Queries refer to their tables and can't be reassigned, so the
+        // query is kept on the heap, allocated once when it's built
+        std::unique_ptr<Query<Tables...>> m_query;
+    };
+
+    template <typename... Tables>
+    inline PersistentQuery<Tables...>& PersistentQuery<Tables...>::operator=(Query<Tables...>&& query)
+    {
+        m_query = std::make_unique<Query<Tables...>>(std::move(query));
+        return *this;
+    }
+
+    template <typename... Tables>
+    inline Query<Tables...>& PersistentQuery<Tables...>::operator*()
+    {
+        assert(built() && "Query hasn't been built");
+        return *m_query;
+    }
+
+    template <typename... Tables>
+    inline Query<Tables...>* PersistentQuery<Tables...>::operator->()
+    {
+        assert(built() && "Query hasn't been built");
+        return m_query.get();
+    }
+}
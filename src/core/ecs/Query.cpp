@@ -7,3 +7,5 @@ eng::Query<> eng::query(const Database& database)
 {
     return Query<>(database);
 }
+
+constexpr uint32_t QueryChunk::k_maxSize;
@@ -1,19 +1,180 @@
 #pragma once
 
+#include <core/ThreadPool.hpp>
 #include <core/ecs/Database.hpp>
+#include <core/ecs/QueryCache.hpp>
 #include <core/ecs/Table.hpp>
 
 namespace eng
 {
+    // Query filter term for a table whose component the matching entities
+    // must not have. The table contributes no argument to query functions.
+    template <typename TableRef>
+    struct ExcludedTable
+    {
+        TableRef table;
+    };
+
+    // Query filter term for a table whose component is passed to query
+    // functions by pointer, or nullptr if the entity doesn't have it.
+    // The table doesn't affect which entities match.
+    template <typename TableRef>
+    struct OptionalTable
+    {
+        TableRef table;
+    };
+
+    // Query filter term for tables whose components the matching entities
+    // must have, of which at least one has been assigned or marked written
+    // with Table::markWritten after change tick 'tick', see Database::changeTick.
+    // The tables contribute no arguments to query functions.
+    template <typename... TableRefs>
+    struct ChangedTable
+    {
+        std::tuple<TableRefs...> tables;
+        uint32_t tick;
+    };
+
+    template <typename T>
+    struct is_excluded_table : std::false_type {};
+    template <typename TableRef>
+    struct is_excluded_table<ExcludedTable<TableRef>> : std::true_type {};
+
+    template <typename T>
+    struct is_optional_table : std::false_type {};
+    template <typename TableRef>
+    struct is_optional_table<OptionalTable<TableRef>> : std::true_type {};
+
+    template <typename T>
+    struct is_tag_table : std::false_type {};
+    template <typename Tag, typename Index>
+    struct is_tag_table<Table<Tag, true, Index>> : std::true_type {};
+
+    template <typename T>
+    struct is_changed_table : std::false_type {};
+    template <typename... TableRefs>
+    struct is_changed_table<ChangedTable<TableRefs...>> : std::true_type {};
+
+    // Table type of a query filter term.
+    template <typename T>
+    struct query_table { using type = std::decay_t<T>; };
+    template <typename TableRef>
+    struct query_table<ExcludedTable<TableRef>> { using type = std::decay_t<TableRef>; };
+    template <typename TableRef>
+    struct query_table<OptionalTable<TableRef>> { using type = std::decay_t<TableRef>; };
+
+    // Number of tables of a query filter term.
+    template <typename T>
+    struct term_table_count : std::integral_constant<size_t, 1u> {};
+    template <typename... TableRefs>
+    struct term_table_count<ChangedTable<TableRefs...>> :
+        std::integral_constant<size_t, sizeof...(TableRefs)> {};
+
+    // True if all tables of a query filter term are indexed by SparseIndex.
+    template <typename T>
+    struct is_sparse_indexed :
+        std::is_same<typename query_table<T>::type::IndexType, SparseIndex> {};
+    template <typename... TableRefs>
+    struct is_sparse_indexed<ChangedTable<TableRefs...>> : std::is_same<
+        std::tuple<typename std::decay_t<TableRefs>::IndexType...>,
+        std::tuple<std::conditional_t<true, SparseIndex, TableRefs>...>> {};
+
+    // Run of consecutive entities passed to Query::executeChunks.
+    struct QueryChunk
+    {
+        // Maximum number of entities in a run.
+        static constexpr uint32_t k_maxSize = 64u;
+
+        // Ids of the entities in the run, in the same order as the component spans.
+        Span<const EntityId> ids;
+        // Bit i is set if the i:th entity of the run matches the query filter.
+        uint64_t mask;
+
+        size_t size() const { return ids.size(); }
+        // Return true if all entities of the run match the query filter.
+        bool dense() const { return mask == fullMask(static_cast<uint32_t>(size())); }
+
+        // Return mask with the lowest 'count' bits set.
+        static uint64_t fullMask(uint32_t count)
+        {
+            return count >= k_maxSize ? ~uint64_t(0) : (uint64_t(1) << count) - 1u;
+        }
+    };
+
+    // Strategy of a query for finding the entities which match its filter.
+    enum class QueryStrategy
+    {
+        // Walk the smallest required table and probe each of its entities
+        ProbeSmallest,
+        // Intersect the bitset indices of the tables a block at a time
+        IntersectBitsets
+    };
+
+    // Strategy chosen by Query::plan() from the cardinalities of the query's
+    // tables. Costs are estimates in units of bitset word operations.
+    struct QueryPlan
+    {
+        QueryStrategy strategy = QueryStrategy::ProbeSmallest;
+        // Position of the smallest table among the required tables
+        size_t smallest = 0u;
+        // Number of entities in the smallest table
+        size_t smallestSize = 0u;
+        // True if entities are probed by their signatures, see Database::sync
+        bool synced = false;
+        size_t probeCost = 0u;
+        size_t intersectCost = std::numeric_limits<size_t>::max();
+    };
+
+#ifndef NDEBUG
+    // Selectivity statistics of a query, collected in debug builds for each
+    // execution which visits all matches.
+    struct QueryStats
+    {
+        // Number of executions which used each strategy
+        size_t probes = 0u;
+        size_t intersections = 0u;
+        // Entities in the smallest table, and matches, summed over all executions
+        size_t candidates = 0u;
+        size_t matches = 0u;
+
+        // Return the fraction of entities in the smallest table which matched.
+        double selectivity() const
+        {
+            return candidates > 0u ? static_cast<double>(matches) / candidates : 0.0;
+        }
+    };
+#endif
+
     template <typename... Tables>
     class Query : public trait::non_copyable
     {
     public:
+        // Create a query over the tables, resolving the signatures which
+        // entities are matched against once, as table bits never change.
         Query(
             const Database& database, 
             Tables... tables) : 
             m_database(database),
-            m_tables(tables...) {}
+            m_tables(tables...)
+        {
+            forEachRequired([&](const auto& table)
+            {
+                m_mask.set(table.componentBit());
+            });
+
+            forEachExcluded([&](const auto& table)
+            {
+                m_excluded.set(table.componentBit());
+            });
+
+            forEachFilter([&](const auto& table)
+            {
+                if (is_tag_table<std::decay_t<decltype(table)>>::value)
+                {
+                    m_tags.set(table.componentBit());
+                }
+            });
+        }
         Query(Query&&) = default;
         Query& operator=(Query&&) = default;
 
@@ -23,7 +184,8 @@ namespace eng
         {
             assertComponent<Component>();
 
-            return newQuery(m_database.table<Component>(), std::index_sequence_for<Tables...>());
+            return newQuery<ConstTableRef<Component>>(
+                m_database.table<Component>(), std::index_sequence_for<Tables...>());
         }
 
         // Transform this query filter to include a mutable component table.
@@ -32,81 +194,444 @@ namespace eng
         {
             assertComponent<Component>();
 
-            return newQuery(table, std::index_sequence_for<Tables...>());
+            return newQuery<TableRef<Component>>(table, std::index_sequence_for<Tables...>());
+        }
+
+        // Transform this query filter to exclude entities which have a component.
+        template <typename Component>
+        auto without()
+        {
+            assertComponent<Component>();
+
+            return newQuery<ExcludedTable<ConstTableRef<Component>>>(
+                { m_database.table<Component>() }, std::index_sequence_for<Tables...>());
+        }
+
+        // Transform this query filter to pass a read-only component by pointer,
+        // which is nullptr for matching entities without the component.
+        template <typename Component>
+        auto maybe()
+        {
+            assertComponent<Component>();
+
+            return newQuery<OptionalTable<ConstTableRef<Component>>>(
+                { m_database.table<Component>() }, std::index_sequence_for<Tables...>());
+        }
+
+        // Transform this query filter to pass a mutable component by pointer.
+        template <typename Component>
+        auto maybe(TableRef<Component> table)
+        {
+            assertComponent<Component>();
+
+            return newQuery<OptionalTable<TableRef<Component>>>(
+                { table }, std::index_sequence_for<Tables...>());
+        }
+
+        // Transform this query filter to include only entities which have all
+        // the components, and of which any has been assigned, or marked written
+        // with Table::markWritten, after change tick 'tick'. Writes through query
+        // references aren't tracked, so systems mark the components they actually
+        // change. Systems typically pass the tick of their previous update, so
+        // that they see changes made since then, including those of systems
+        // executed after them, but not their own writes, which are stamped with
+        // the tick of that update.
+        template <typename... Components>
+        auto changedSince(uint32_t tick)
+        {
+            static_assert(sizeof...(Components) > 0, "Query argument must be a component");
+            doInOrder([&] { assertChangeable<Components>(); }...);
+
+            using Term = ChangedTable<ConstTableRef<Components>...>;
+            return newQuery<Term>(
+                { typename std::tuple<ConstTableRef<Components>...>(m_database.table<Components>()...), tick },
+                std::index_sequence_for<Tables...>());
+        }
+
+        // Set the change tick of all changedSince() terms of the query, so
+        // that a persistent query can be executed for changes of each update.
+        void setChangedSince(uint32_t tick)
+        {
+            forEach(std::index_sequence_for<Tables...>(), m_tables, [&](auto& term)
+            {
+                setTick(term, tick);
+            });
         }
 
         // Execute a function for all entities which match the query filter.
         // The function parameters must adhere to the order and constness of
-        // the query filter arguments.
+        // the query filter arguments. Excluded components are not passed,
+        // and optional components are passed by pointer. Matches are found
+        // while the function executes, so components of the query's tables
+        // must not be added or removed until the query has finished; defer
+        // such changes e.g. by collecting the ids first.
         template <typename F>
         void execute(F&& process)
         {
-            for (auto&& id : ids())
+            if (archetypeBacked())
+            {
+                executeArchetypes(process, std::index_sequence_for<Tables...>());
+                return;
+            }
+
+            forEachMatch([&](EntityId id)
             {
                 processImpl(id, process, std::index_sequence_for<Tables...>());
+            });
+        }
+
+        // Execute a function for all entities which match the query filter,
+        // reusing the matching ids of 'cache' if none of the tables have had
+        // components added or removed since the ids were computed.
+        template <typename F>
+        void execute(QueryCache& cache, F&& process)
+        {
+            if (archetypeBacked())
+            {
+                // Archetype chunks are already grouped by signature
+                executeArchetypes(process, std::index_sequence_for<Tables...>());
+                return;
+            }
+
+            for (EntityId id : ids(cache))
+            {
+                if (changed(id))
+                {
+                    processImpl(id, process, std::index_sequence_for<Tables...>());
+                }
+            }
+        }
+
+        // Execute a function for all entities which match the query filter,
+        // split into ranges of entities which are executed in parallel on
+        // 'pool'. Components of read-only tables are passed as const, so only
+        // mutable tables are written. The function must be safe to call
+        // concurrently, and must not add or remove components.
+        template <typename F>
+        void executeParallel(F&& process, ThreadPool& pool = ThreadPool::shared())
+        {
+            // Number of tasks per thread, to balance uneven entity distributions
+            static constexpr size_t k_tasksPerThread = 4u;
+            // Minimum number of blocks per task, to amortize scheduling
+            static constexpr size_t k_minBlocksPerTask = 16u;
+
+            if (archetypeBacked())
+            {
+                std::vector<std::pair<const Archetype*, size_t>> chunks;
+
+                forEachArchetypeChunk([&](const Archetype& archetype, size_t chunk)
+                {
+                    chunks.emplace_back(&archetype, chunk);
+                });
+
+                pool.parallelFor(chunks.size(), [&](size_t task)
+                {
+                    executeChunk(process, *chunks[task].first, chunks[task].second,
+                        std::index_sequence_for<Tables...>());
+                });
+                return;
+            }
+
+            const SparseIndex matches = index();
+            const size_t blockCount = matches.blockCount();
+
+            const size_t maxTasks = static_cast<size_t>(pool.threadCount()) * k_tasksPerThread;
+            const size_t blocksPerTask = (std::max)(k_minBlocksPerTask, (blockCount + maxTasks - 1) / maxTasks);
+            const size_t taskCount = (blockCount + blocksPerTask - 1) / blocksPerTask;
+
+            pool.parallelFor(taskCount, [&](size_t task)
+            {
+                const size_t first = task * blocksPerTask;
+
+                matches.forEachInBlocks(first, first + blocksPerTask, [&](uint32_t index)
+                {
+                    processImpl(m_database.entity(index), process, std::index_sequence_for<Tables...>());
+                });
+            });
+        }
+
+        // Execute a function for runs of consecutive entities which match the
+        // query filter, called with a QueryChunk and a span of components per
+        // component table, in the order and constness of the query filter
+        // arguments. Tag and excluded tables pass no span, and optional tables
+        // pass an empty span if none of the entities have the component.
+        // Entities which are clear in the chunk mask don't match the filter,
+        // but still have their components in the spans. Runs are longest when
+        // the components of the tables are compacted into entity order.
+        template <typename F>
+        void executeChunks(F&& process)
+        {
+            if (archetypeBacked())
+            {
+                forEachArchetypeChunk([&](const Archetype& archetype, size_t chunk)
+                {
+                    executeArchetypeRuns(process, archetype, chunk, std::index_sequence_for<Tables...>());
+                });
+                return;
             }
+
+            const SparseIndex matches = index();
+
+            matches.forEachBlock([&](EntityId first, uint64_t bits)
+            {
+                executeRuns(process, first, bits);
+            });
         }
 
         // Execute a function for all entities which match the query filter.
         template <typename F>
         void executeIds(F&& process)
         {
-            for (auto&& id : ids())
+            forEachMatch(process);
+        }
+
+        template <typename F>
+        void executeIds(QueryCache& cache, F&& process)
+        {
+            for (EntityId id : ids(cache))
             {
-                process(id);
+                if (changed(id))
+                {
+                    process(id);
+                }
             }
         }
 
         // Return component data of first entity which matches the query filter,
-        // or nullptr if no matches were found.
+        // or nullptr if no matches were found. Stops at the first match.
         template <typename Component>
         const Component* find()
         {
             assertComponent<Component>();
 
-            auto ids = hasComponent<Component>().ids();
-            if (!ids.empty())
+            auto query = hasComponent<Component>();
+
+            auto it = query.begin();
+            if (it != query.end())
             {
-                return m_database.table<Component>()[ids[0]];
+                return m_database.table<Component>()[*it];
             }
             return nullptr;
         }
 
-        // Return sparse index containing all entity ids which match the query filter.
+        // Return signature of the component tables which entities must have
+        // to match the query filter.
+        const Signature& signature() const
+        {
+            return m_mask;
+        }
+
+        // Return signature of the component tables excluded by the query filter.
+        const Signature& excludedSignature() const
+        {
+            return m_excluded;
+        }
+
+        // Return sparse index containing the indices of all entities which match the query filter.
         SparseIndex index()
         {
-            if (sizeof...(Tables) == 0)
+            m_plan = plan();
+
+            SparseIndex index;
+
+            if (m_plan.strategy == QueryStrategy::IntersectBitsets)
+            {
+                index = intersectIndices(std::integral_constant<bool, bitsetIndexed()>());
+            }
+            else
             {
-                return SparseIndex();
+                forEachProbe([&](EntityId id)
+                {
+                    index.insert(entityIndex(id));
+                });
             }
 
-            auto& table = std::get<0>(m_tables);
-            SparseIndex index = table.index();
+            if (changedCount() > 0)
+            {
+                SparseIndex changedIndex;
 
-            forEach(std::index_sequence_for<Tables...>(), m_tables,
-                [&](const auto& table)
+                for (auto entity : index)
+                {
+                    if (changed(entity))
+                    {
+                        changedIndex.insert(entity);
+                    }
+                }
+
+                index = std::move(changedIndex);
+            }
+
+            recordStats(index.size());
+            return index;
+        }
+
+        // Return the strategy for finding the matching entities. Probing costs
+        // a memory access per table for each entity in the smallest table, and
+        // is chosen when one table is much smaller than the others. Bitset
+        // intersection costs the same for each block of 64 entities which may
+        // hold matches, and is chosen for tables of similar size.
+        QueryPlan plan()
+        {
+            QueryPlan plan;
+            plan.smallestSize = std::numeric_limits<size_t>::max();
+            plan.synced = signaturesSynced();
+
+            size_t i = 0u;
+
+            forEachRequired([&](const auto& table)
             {
-                index &= table.index();
+                if (table.size() < plan.smallestSize)
+                {
+                    plan.smallest = i;
+                    plan.smallestSize = table.size();
+                }
+                ++i;
             });
 
-            return index;
+            if (requiredCount() == 0)
+            {
+                plan.smallestSize = 0u;
+                return plan;
+            }
+
+            // Signatures match all tables at once, indices are probed one by one
+            const size_t probesPerEntity = plan.synced ? 1u : requiredCount() + excludedCount() - 1u;
+
+            plan.probeCost = plan.smallestSize * (1u + k_probeCost * probesPerEntity);
+            plan.intersectCost = intersectCost(std::integral_constant<bool, bitsetIndexed()>());
+
+            if (plan.intersectCost < plan.probeCost)
+            {
+                plan.strategy = QueryStrategy::IntersectBitsets;
+            }
+
+            return plan;
         }
 
+#ifndef NDEBUG
+        // Return selectivity statistics of the executions of this query.
+        const QueryStats& stats() const
+        {
+            return m_stats;
+        }
+#endif
+
         // Return all entity ids which match the query filter.
         std::vector<EntityId> ids()
         {
             std::vector<EntityId> ids;
 
-            auto idx = index();
+            forEachMatch([&](EntityId id)
+            {
+                ids.emplace_back(id);
+            });
+
+            return ids;
+        }
+
+        // Return all entity ids which match the query filter, recomputed
+        // into 'cache' only if the structure of the tables has changed.
+        // The ids are not filtered by changedSince() terms, which are
+        // applied when the query is executed with the cache.
+        const std::vector<EntityId>& ids(QueryCache& cache)
+        {
+            // Optional tables don't affect which entities match
+            std::array<QueryCache::TableVersion, requiredCount() + excludedCount()> versions{};
+            size_t i = 0;
+
+            forEachRequired([&](const auto& table)
+            {
+                versions[i++] = { &table, table.structuralVersion(), false };
+            });
+
+            forEachExcluded([&](const auto& table)
+            {
+                versions[i++] = { &table, table.structuralVersion(), true };
+            });
+
+            if (!cache.current(versions.data(), versions.size()))
+            {
+                std::vector<EntityId>& ids = cache.rebuild(versions.data(), versions.size());
+
+                forEachMatch([&](EntityId id)
+                {
+                    ids.emplace_back(id);
+                }, false);
+            }
+
+            return cache.ids();
+        }
+
+    public:
+        // Input iterator over the ids of entities which match the query filter.
+        // Each match is found only when the iterator is advanced to it, so that
+        // iteration can stop early without visiting the remaining entities.
+        class Iterator : public std::iterator<
+            std::input_iterator_tag,
+            EntityId,
+            uint32_t,
+            const EntityId*,
+            EntityId>
+        {
+        public:
+            explicit Iterator(
+                Query& query,
+                size_t cursor,
+                uint32_t index) :
+                m_query(&query),
+                m_cursor(cursor),
+                m_index(index)
+            {}
 
-            auto it = idx.begin();
-            while (it != idx.end())
+            Iterator& operator++()
             {
-                ids.emplace_back(*it);
-                ++it;
+                m_index = m_query->nextMatch(m_cursor);
+                return *this;
             }
 
-            return ids;
+            Iterator operator++(int)
+            {
+                Iterator it = *this;
+                ++(*this);
+                return it;
+            }
+
+            bool operator==(const Iterator& other) const { return m_index == other.m_index; }
+            bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+            reference operator*() const
+            {
+                return m_query->m_database.entity(m_index);
+            }
+
+        private:
+            Query* m_query;
+            // Position of the next candidate entity in the smallest table
+            size_t m_cursor;
+            // Entity index of the current match
+            uint32_t m_index;
+        };
+
+        // Return iterator to the first entity which matches the query filter.
+        // Iterators refer to the query, so it must outlive them, and the tables
+        // must not have components added or removed during iteration. Iterating
+        // the query itself in a range-based for loop allocates no memory:
+        //
+        //     for (EntityId id : query(database).hasComponent<Camera>()) { ... }
+        Iterator begin()
+        {
+            // Iterators always probe the smallest table, to find matches one at a time
+            m_plan = plan();
+
+            size_t cursor = 0u;
+            const uint32_t index = requiredCount() > 0 ? nextMatch(cursor) : k_noMatch;
+
+            return Iterator(*this, cursor, index);
+        }
+
+        Iterator end()
+        {
+            return Iterator(*this, 0u, k_noMatch);
         }
 
         // TODO: Remove, old implementation for id fetch which is 
@@ -115,8 +640,7 @@ namespace eng
         {
             std::unordered_map<EntityId, unsigned> idCounts;
 
-            forEach(std::index_sequence_for<Tables...>(), m_tables,
-                [&](const auto& table)
+            forEachRequired([&](const auto& table)
             {
                 // Insert all ids from query tables into map,
                 // incrementing occurrence counter as we go
@@ -132,7 +656,19 @@ namespace eng
             {
                 // If id count matches the amount of query tables,
                 // the id was located in all tables and is a match
-                if (kv.second == sizeof...(Tables))
+                if (kv.second != requiredCount())
+                {
+                    continue;
+                }
+
+                bool excluded = false;
+
+                forEachExcluded([&](const auto& table)
+                {
+                    excluded = excluded || table.check(kv.first);
+                });
+
+                if (!excluded)
                 {
                     ids.emplace_back(kv.first);
                 }
@@ -149,47 +685,1138 @@ namespace eng
                 "Query argument must be a component");
         }
 
-        template <typename T, size_t... Is>
-        auto newQuery(T&& table, std::index_sequence<Is...>)
+        template <typename Component>
+        constexpr void assertChangeable()
+        {
+            assertComponent<Component>();
+            static_assert(!std::is_base_of<ITag, Component>::value,
+                "Tags carry no data to be written");
+        }
+
+        template <typename Term, size_t... Is>
+        auto newQuery(Term term, std::index_sequence<Is...>)
         {
-            return Query<Tables..., decltype(table)>(
+            return Query<Tables..., Term>(
                 m_database,
                 std::get<Is>(m_tables)...,
-                table);
+                term);
         }
 
         template <size_t... Is, typename Tuple, typename F>
-        void forEach(std::index_sequence<Is...>, Tuple&& tuple, F&& f) 
+        static void forEach(std::index_sequence<Is...>, Tuple&& tuple, F&& f)
         {
             // Unpack 'tuple' and execute 'f' for each value
             doInOrder([&] { f(std::get<Is>(std::forward<Tuple>(tuple))); }...);
         }
 
         template <typename... F>
-        void doInOrder(F&&... f)
+        static void doInOrder(F&&... f)
         {
             // Use comma operator to call each function in parameter pack
             int unused[] = { 0, ((void) std::forward<F>(f)(), 0)... };
             (void) unused; // Prevent warning
         }
 
-        template <typename F, size_t... Is>
-        void processImpl(EntityId id, F&& f, std::index_sequence<Is...>)
+        // Number of tables which entities must have to match the query filter.
+        static constexpr size_t requiredCount()
         {
-            decltype(auto) getComponent = [](EntityId id, auto& table)
+            const size_t tables[] = { 0u, (is_excluded_table<Tables>::value ||
+                is_optional_table<Tables>::value ? 0u : term_table_count<Tables>::value)... };
+
+            size_t count = 0;
+            for (size_t value : tables)
             {
-                assert(table[id] != nullptr && "Entity doesn't have component");
-                return table[id];
-            };
+                count += value;
+            }
+            return count;
+        }
+
+        static constexpr size_t excludedCount()
+        {
+            const bool excluded[] = { false, is_excluded_table<Tables>::value... };
 
-            f(id, *getComponent(id, std::get<Is>(m_tables))...);
+            size_t count = 0;
+            for (bool value : excluded)
+            {
+                count += value ? 1 : 0;
+            }
+            return count;
         }
 
-    private:
-        const Database& m_database;
+        static constexpr size_t changedCount()
+        {
+            const bool changed[] = { false, is_changed_table<Tables>::value... };
 
-        std::tuple<Tables...> m_tables;
-    };
+            size_t count = 0;
+            for (bool value : changed)
+            {
+                count += value ? 1 : 0;
+            }
+            return count;
+        }
+
+        static constexpr size_t tagCount()
+        {
+            const bool tag[] = { false, is_tag_table<typename query_table<Tables>::type>::value... };
+
+            size_t count = 0;
+            for (bool value : tag)
+            {
+                count += value ? 1 : 0;
+            }
+            return count;
+        }
+
+        static constexpr size_t optionalCount()
+        {
+            const bool optional[] = { false, is_optional_table<Tables>::value... };
+
+            size_t count = 0;
+            for (bool value : optional)
+            {
+                count += value ? 1 : 0;
+            }
+            return count;
+        }
+
+        // Call 'f' with the table of a filter term if the term is of a selected kind.
+        template <bool Required, bool Excluded, bool Optional, typename Table, typename F>
+        static void visitTerm(Table& table, F& f)
+        {
+            visitIf(std::integral_constant<bool, Required>(), table, f);
+        }
+
+        template <bool Required, bool Excluded, bool Optional, typename TableRef, typename F>
+        static void visitTerm(ExcludedTable<TableRef>& term, F& f)
+        {
+            visitIf(std::integral_constant<bool, Excluded>(), term.table, f);
+        }
+
+        template <bool Required, bool Excluded, bool Optional, typename TableRef, typename F>
+        static void visitTerm(OptionalTable<TableRef>& term, F& f)
+        {
+            visitIf(std::integral_constant<bool, Optional>(), term.table, f);
+        }
+
+        // Entities must have the components of all changed tables.
+        template <bool Required, bool Excluded, bool Optional, typename... TableRefs, typename F>
+        static void visitTerm(ChangedTable<TableRefs...>& term, F& f)
+        {
+            forEach(std::index_sequence_for<TableRefs...>(), term.tables, [&](auto& table)
+            {
+                visitIf(std::integral_constant<bool, Required>(), table, f);
+            });
+        }
+
+        template <typename Table, typename F>
+        static void visitIf(std::true_type, Table& table, F& f) { f(table); }
+        template <typename Table, typename F>
+        static void visitIf(std::false_type, Table&, F&) {}
+
+        // Execute a function for each table which entities must have.
+        template <typename F>
+        void forEachRequired(F&& f)
+        {
+            forEach(std::index_sequence_for<Tables...>(), m_tables,
+                [&](auto& term) { visitTerm<true, false, false>(term, f); });
+        }
+
+        // Execute a function for each table which entities must not have.
+        template <typename F>
+        void forEachExcluded(F&& f)
+        {
+            forEach(std::index_sequence_for<Tables...>(), m_tables,
+                [&](auto& term) { visitTerm<false, true, false>(term, f); });
+        }
+
+        // Execute a function for each table which determines the matching entities.
+        template <typename F>
+        void forEachFilter(F&& f)
+        {
+            forEach(std::index_sequence_for<Tables...>(), m_tables,
+                [&](auto& term) { visitTerm<true, true, false>(term, f); });
+        }
+
+        // Execute a function for each table in the query.
+        template <typename F>
+        void forEachTable(F&& f)
+        {
+            forEach(std::index_sequence_for<Tables...>(), m_tables,
+                [&](auto& term) { visitTerm<true, true, true>(term, f); });
+        }
+
+        // Return the sum of the structural versions of all tables in the query,
+        // which changes whenever any of them has components added or removed.
+        uint64_t structuralVersion()
+        {
+            uint64_t version = 0u;
+
+            forEachTable([&](const auto& table)
+            {
+                version += table.structuralVersion();
+            });
+
+            return version;
+        }
+
+        // Return true if the entity signatures of the database are up to date
+        // with all tables in the query, so that they can be used for matching.
+        bool signaturesSynced()
+        {
+            bool synced = requiredCount() > 0;
+
+            forEachFilter([&](const auto& table)
+            {
+                synced = synced && table.synced();
+            });
+
+            return synced;
+        }
+
+        // Return true if all filtering tables in the query are indexed by
+        // SparseIndex, so that their indices can be intersected a block at a time.
+        static constexpr bool bitsetIndexed()
+        {
+            const bool indexed[] = { true,
+                (is_optional_table<Tables>::value || is_sparse_indexed<Tables>::value)... };
+
+            bool all = true;
+            for (bool value : indexed)
+            {
+                all = all && value;
+            }
+            return all;
+        }
+
+        // Estimate the cost of intersecting the indices of the tables, from the
+        // number of summary words and of blocks which may hold matches.
+        size_t intersectCost(std::true_type)
+        {
+            size_t blocks = std::numeric_limits<size_t>::max();
+            size_t candidates = std::numeric_limits<size_t>::max();
+
+            forEachRequired([&](const auto& table)
+            {
+                const SparseIndex& index = table.index();
+                blocks = (std::min)(blocks, index.blockCount());
+                candidates = (std::min)(candidates, (std::min)(index.size(), index.blockCount()));
+            });
+
+            // Each summary word covers 64 blocks
+            const size_t summaryWords = (blocks + 63u) / 64u;
+
+            return requiredCount() * summaryWords + k_probeCost * (requiredCount() + excludedCount()) * candidates;
+        }
+
+        // Tables which aren't all bitset indexed can only be probed.
+        size_t intersectCost(std::false_type)
+        {
+            return std::numeric_limits<size_t>::max();
+        }
+
+        // Update the debug statistics of the plan after an execution.
+        void recordStats(size_t matchCount)
+        {
+#ifndef NDEBUG
+            if (m_plan.strategy == QueryStrategy::IntersectBitsets)
+            {
+                m_stats.intersections++;
+            }
+            else
+            {
+                m_stats.probes++;
+            }
+
+            m_stats.candidates += m_plan.smallestSize;
+            m_stats.matches += matchCount;
+#else
+            (void) matchCount;
+#endif
+        }
+
+        // Execute a function for each entity index in the smallest table of the plan.
+        template <typename F>
+        void forEachSmallest(F&& f)
+        {
+            size_t i = 0u;
+
+            forEachRequired([&](const auto& table)
+            {
+                if (i++ == m_plan.smallest)
+                {
+                    for (auto&& index : table.index())
+                    {
+                        f(index);
+                    }
+                }
+            });
+        }
+
+        // Return the indices of all tables in the query, smallest first
+        // so that fused intersections can bail out of blocks early.
+        std::array<const SparseIndex*, requiredCount()> tableIndices()
+        {
+            std::array<const SparseIndex*, requiredCount()> indices{};
+            size_t i = 0;
+
+            forEachRequired([&](const auto& table)
+            {
+                indices[i++] = &table.index();
+            });
+
+            std::sort(indices.begin(), indices.end(),
+                [](const SparseIndex* lhs, const SparseIndex* rhs)
+            {
+                return lhs->size() < rhs->size();
+            });
+
+            return indices;
+        }
+
+        // Return the indices of all excluded tables in the query.
+        std::array<const SparseIndex*, excludedCount()> excludedIndices()
+        {
+            std::array<const SparseIndex*, excludedCount()> indices{};
+            size_t i = 0;
+
+            forEachExcluded([&](const auto& table)
+            {
+                indices[i++] = &table.index();
+            });
+
+            return indices;
+        }
+
+        // Return intersection of the indices of all tables in the query,
+        // with the indices of excluded tables masked out.
+        SparseIndex intersectIndices(std::true_type)
+        {
+            auto indices = tableIndices();
+            auto excluded = excludedIndices();
+            return SparseIndex::intersection(
+                indices.data(), indices.size(),
+                excluded.data(), excluded.size());
+        }
+
+        // Tables which aren't all bitset indexed are never planned for intersection.
+        SparseIndex intersectIndices(std::false_type)
+        {
+            assert(false && "Only bitset indices can be intersected");
+            return SparseIndex();
+        }
+
+        // Execute a function for each entity id found in the indices of all
+        // tables in the query, fused a block at a time.
+        template <typename F>
+        void forEachIntersection(F&& f, std::true_type)
+        {
+            auto indices = tableIndices();
+            auto excluded = excludedIndices();
+            SparseIndex::forEachIntersection(
+                indices.data(), indices.size(),
+                excluded.data(), excluded.size(),
+                [&](EntityId index)
+            {
+                f(m_database.entity(index));
+            });
+        }
+
+        template <typename F>
+        void forEachIntersection(F&&, std::false_type)
+        {
+            assert(false && "Only bitset indices can be intersected");
+        }
+
+        // Walk the smallest table of the plan and execute a function for each
+        // of its entities which matches the query filter.
+        template <typename F>
+        void forEachProbe(F&& f)
+        {
+            forEachSmallest([&](uint32_t index)
+            {
+                if (matches(index))
+                {
+                    f(m_database.entity(index));
+                }
+            });
+        }
+
+        // Return the entity index of the next match of the query filter, found
+        // by walking the smallest table from position 'cursor', which is then
+        // advanced past the match. Returns k_noMatch once the table is exhausted.
+        uint32_t nextMatch(size_t& cursor)
+        {
+            while (true)
+            {
+                uint32_t index = k_noMatch;
+                size_t i = 0u;
+
+                forEachRequired([&](const auto& table)
+                {
+                    if (i++ == m_plan.smallest)
+                    {
+                        index = nextCandidate(table.index(), cursor);
+                    }
+                });
+
+                if (index == k_noMatch || (matches(index) && changed(index)))
+                {
+                    return index;
+                }
+            }
+        }
+
+        static uint32_t nextCandidate(const SparseIndex& index, size_t& cursor)
+        {
+            auto it = index.lowerBound(static_cast<EntityId>(cursor));
+            if (it == index.end())
+            {
+                return k_noMatch;
+            }
+
+            cursor = *it + 1u;
+            return *it;
+        }
+
+        static uint32_t nextCandidate(const SparseSet& set, size_t& cursor)
+        {
+            if (cursor >= set.size())
+            {
+                return k_noMatch;
+            }
+
+            return *(set.begin() + cursor++);
+        }
+
+        // Return true if the entity index matches the query filter, probed as in 'm_plan'.
+        // Writes of changedSince() terms are checked separately with changed().
+        bool matches(uint32_t index)
+        {
+            if (m_plan.synced)
+            {
+                // Match against all tables with a single bitwise AND
+                const Signature& signature = m_database.signature(index);
+                return (signature & m_mask) == m_mask && (signature & m_excluded).none();
+            }
+
+            bool match = true;
+
+            forEachRequired([&](const auto& table)
+            {
+                match = match && table.index().check(index);
+            });
+            forEachExcluded([&](const auto& table)
+            {
+                match = match && !table.index().check(index);
+            });
+
+            return match;
+        }
+
+        // Return true if for all changedSince() terms, any component of the
+        // term of an entity has been written after the change tick of the term.
+        bool changed(EntityId id)
+        {
+            bool changed = true;
+
+            forEach(std::index_sequence_for<Tables...>(), m_tables, [&](const auto& term)
+            {
+                changed = changed && termChanged(term, id);
+            });
+
+            return changed;
+        }
+
+        template <typename Term>
+        static bool termChanged(const Term&, EntityId)
+        {
+            return true;
+        }
+
+        template <typename... TableRefs>
+        static bool termChanged(const ChangedTable<TableRefs...>& term, EntityId id)
+        {
+            bool changed = false;
+
+            forEach(std::index_sequence_for<TableRefs...>(), term.tables, [&](const auto& table)
+            {
+                changed = changed || table.writeTick(id) > term.tick;
+            });
+
+            return changed;
+        }
+
+        template <typename Term>
+        static void setTick(Term&, uint32_t)
+        {
+        }
+
+        template <typename... TableRefs>
+        static void setTick(ChangedTable<TableRefs...>& term, uint32_t tick)
+        {
+            term.tick = tick;
+        }
+
+        // Execute a function for each entity id which matches the query filter,
+        // found with the strategy of the query plan.
+        template <typename F>
+        void forEachMatch(F&& f)
+        {
+            forEachMatch(f, changedCount() > 0);
+        }
+
+        // Execute a function for all entities which match the query filter.
+        // If 'filterChanged' is false, changedSince() terms only require that
+        // the entities have the component, as with structural cache rebuilds.
+        template <typename F>
+        void forEachMatch(F&& f, bool filterChanged)
+        {
+            m_plan = plan();
+
+            size_t matchCount = 0u;
+            const uint64_t version = structuralVersion();
+
+            auto match = [&](EntityId id)
+            {
+                if (!filterChanged || changed(id))
+                {
+                    ++matchCount;
+                    f(id);
+
+                    // Table indices are walked while the function executes
+                    assert(structuralVersion() == version &&
+                        "Cannot add or remove components while executing query");
+                }
+            };
+
+            (void) version;
+
+            if (m_plan.strategy == QueryStrategy::IntersectBitsets)
+            {
+                forEachIntersection(match, std::integral_constant<bool, bitsetIndexed()>());
+            }
+            else
+            {
+                forEachProbe(match);
+            }
+
+            recordStats(matchCount);
+        }
+
+        // Return true if all component tables in the query store their
+        // components in the database's archetype storage.
+        bool archetypeBacked()
+        {
+            // Tag tables only have an index, and are matched per entity
+            bool backed = false;
+
+            forEachRequired([&](const auto& table)
+            {
+                backed = backed || table.archetypes() != nullptr;
+            });
+
+            forEachTable([&](const auto& table)
+            {
+                backed = backed && (is_tag_table<std::decay_t<decltype(table)>>::value || table.archetypes() != nullptr);
+            });
+
+            return backed;
+        }
+
+        // Return true if an entity of an archetype chunk matches the tag
+        // terms of the query, which archetype signatures don't include.
+        bool tagsMatch(EntityId id)
+        {
+            bool match = true;
+
+            forEachRequired([&](const auto& table)
+            {
+                match = match && tagMatch(table, id, true);
+            });
+
+            forEachExcluded([&](const auto& table)
+            {
+                match = match && tagMatch(table, id, false);
+            });
+
+            return match;
+        }
+
+        template <typename Tag, typename Index>
+        static bool tagMatch(const Table<Tag, true, Index>& table, EntityId id, bool required)
+        {
+            return table.check(id) == required;
+        }
+
+        template <typename TableType>
+        static bool tagMatch(const TableType&, EntityId, bool)
+        {
+            return true;
+        }
+
+        // Return true if an entity of an archetype chunk matches the
+        // per-entity terms of the query.
+        bool rowMatches(EntityId id)
+        {
+            return tagsMatch(id) && changed(id);
+        }
+
+        template <typename Component, typename Index>
+        static Component* archetypeColumn(
+            Table<Component, false, Index>& table,
+            const Archetype& archetype,
+            size_t chunk)
+        {
+            return static_cast<Component*>(archetype.column(chunk, table.componentBit()));
+        }
+
+        template <typename Component, typename Index>
+        static const Component* archetypeColumn(
+            const Table<Component, false, Index>& table,
+            const Archetype& archetype,
+            size_t chunk)
+        {
+            return static_cast<const Component*>(archetype.column(chunk, table.componentBit()));
+        }
+
+        // Column of a tag table, which isn't stored in archetypes, so its
+        // arguments are looked up per entity.
+        template <typename TableType>
+        struct TagColumn
+        {
+            TableType* table;
+        };
+
+        template <typename Tag, typename Index>
+        static TagColumn<Table<Tag, true, Index>> archetypeColumn(
+            Table<Tag, true, Index>& table,
+            const Archetype&,
+            size_t)
+        {
+            return { &table };
+        }
+
+        template <typename Tag, typename Index>
+        static TagColumn<const Table<Tag, true, Index>> archetypeColumn(
+            const Table<Tag, true, Index>& table,
+            const Archetype&,
+            size_t)
+        {
+            return { &table };
+        }
+
+        // Column of an optional component, which may be missing from the archetype.
+        template <typename Component>
+        struct OptionalColumn
+        {
+            Component* data;
+        };
+
+        template <typename TableType>
+        struct OptionalTagColumn
+        {
+            TableType* table;
+        };
+
+        template <typename TableRef>
+        static auto archetypeColumn(
+            OptionalTable<TableRef>& term,
+            const Archetype& archetype,
+            size_t chunk)
+        {
+            return optionalColumn(archetypeColumn(term.table, archetype, chunk));
+        }
+
+        template <typename Component>
+        static OptionalColumn<Component> optionalColumn(Component* data)
+        {
+            return { data };
+        }
+
+        template <typename TableType>
+        static OptionalTagColumn<TableType> optionalColumn(TagColumn<TableType> column)
+        {
+            return { column.table };
+        }
+
+        template <typename TableRef>
+        static std::nullptr_t archetypeColumn(
+            ExcludedTable<TableRef>&,
+            const Archetype&,
+            size_t)
+        {
+            return nullptr;
+        }
+
+        template <typename... TableRefs>
+        static std::nullptr_t archetypeColumn(
+            ChangedTable<TableRefs...>&,
+            const Archetype&,
+            size_t)
+        {
+            return nullptr;
+        }
+
+        // Return the query function arguments of a column for the entity of a row.
+        template <typename Component>
+        static auto rowArguments(Component* column, EntityId, uint32_t row)
+        {
+            return std::forward_as_tuple(column[row]);
+        }
+
+        template <typename Component>
+        static auto rowArguments(OptionalColumn<Component> column, EntityId, uint32_t row)
+        {
+            return std::make_tuple(column.data ? column.data + row : nullptr);
+        }
+
+        template <typename TableType>
+        static auto rowArguments(TagColumn<TableType> column, EntityId id, uint32_t)
+        {
+            return std::forward_as_tuple(*(*column.table)[id]);
+        }
+
+        template <typename TableType>
+        static auto rowArguments(OptionalTagColumn<TableType> column, EntityId id, uint32_t)
+        {
+            return std::make_tuple((*column.table)[id]);
+        }
+
+        static std::tuple<> rowArguments(std::nullptr_t, EntityId, uint32_t)
+        {
+            return std::tuple<>();
+        }
+
+        // Return archetype storage of the tables, when archetype backed.
+        const ArchetypeStorage& archetypeStorage()
+        {
+            const ArchetypeStorage* storage = nullptr;
+
+            forEachRequired([&](const auto& table)
+            {
+                storage = storage ? storage : table.archetypes();
+            });
+
+            return *storage;
+        }
+
+        // Execute a function for each non-empty chunk of all archetypes which
+        // match the query filter.
+        template <typename F>
+        void forEachArchetypeChunk(F&& f)
+        {
+            // Tags are matched per entity with rowMatches
+            const Signature excluded = m_excluded & ~m_tags;
+
+            archetypeStorage().forEachChunk(m_mask & ~m_tags, [&](const Archetype& archetype, size_t chunk)
+            {
+                if ((archetype.signature() & excluded).none())
+                {
+                    f(archetype, chunk);
+                }
+            });
+        }
+
+        template <typename F, size_t... Is>
+        void executeChunk(F& f, const Archetype& archetype, size_t chunk, std::index_sequence<Is...>)
+        {
+            const EntityId* ids = archetype.ids(chunk);
+            const uint32_t count = archetype.entityCount(chunk);
+
+            auto columns = std::make_tuple(
+                archetypeColumn(std::get<Is>(m_tables), archetype, chunk)...);
+
+            for (uint32_t row = 0; row < count; ++row)
+            {
+                if (!rowMatches(ids[row]))
+                {
+                    continue;
+                }
+
+                apply(f, std::tuple_cat(
+                    std::make_tuple(ids[row]),
+                    rowArguments(std::get<Is>(columns), ids[row], row)...));
+            }
+        }
+
+        template <typename F, size_t... Is>
+        void executeArchetypes(F&& f, std::index_sequence<Is...> sequence)
+        {
+            const ArchetypeStorage& storage = archetypeStorage();
+            const uint64_t structuralVersion = storage.structuralVersion();
+
+            // Walk linearly over each chunk of all matching archetypes
+            forEachArchetypeChunk([&](const Archetype& archetype, size_t chunk)
+            {
+                executeChunk(f, archetype, chunk, sequence);
+
+                assert(storage.structuralVersion() == structuralVersion &&
+                    "Cannot add or remove components while executing query");
+            });
+
+            (void) structuralVersion;
+        }
+
+        // Component column of a filter term for a run of entities. The column
+        // is contiguous if the components of all entities of the run are
+        // stored consecutively, or if an optional component is missing from
+        // all of them, in which case 'data' is nullptr.
+        template <typename Component>
+        struct RunColumn
+        {
+            Component* data;
+            bool contiguous;
+        };
+
+        // Column of a filter term which passes no span.
+        struct NoColumn
+        {
+            bool contiguous;
+        };
+
+        template <typename Component, typename TableType>
+        static RunColumn<Component> componentRunColumn(
+            TableType& table,
+            uint32_t first,
+            uint32_t count,
+            EntityId firstId)
+        {
+            if (table.archetypes())
+            {
+                // Archetype rows are only looked up one at a time
+                return { count == 1u ? table[firstId] : nullptr, count == 1u };
+            }
+
+            const uint32_t position = table.contiguousPosition(first, count);
+            if (position == SparseArray::k_invalid)
+            {
+                return { nullptr, false };
+            }
+
+            return { table.components().data() + position, true };
+        }
+
+        template <typename Component, typename Index>
+        static RunColumn<Component> runColumn(
+            Table<Component, false, Index>& table,
+            uint32_t first,
+            uint32_t count,
+            EntityId firstId)
+        {
+            return componentRunColumn<Component>(table, first, count, firstId);
+        }
+
+        template <typename Component, typename Index>
+        static RunColumn<const Component> runColumn(
+            const Table<Component, false, Index>& table,
+            uint32_t first,
+            uint32_t count,
+            EntityId firstId)
+        {
+            return componentRunColumn<const Component>(table, first, count, firstId);
+        }
+
+        template <typename Tag, typename Index>
+        static NoColumn runColumn(const Table<Tag, true, Index>&, uint32_t, uint32_t, EntityId)
+        {
+            return { true };
+        }
+
+        template <typename TableRef>
+        static NoColumn runColumn(ExcludedTable<TableRef>&, uint32_t, uint32_t, EntityId)
+        {
+            return { true };
+        }
+
+        template <typename... TableRefs>
+        static NoColumn runColumn(ChangedTable<TableRefs...>&, uint32_t, uint32_t, EntityId)
+        {
+            return { true };
+        }
+
+        template <typename TableRef>
+        static auto runColumn(
+            OptionalTable<TableRef>& term,
+            uint32_t first,
+            uint32_t count,
+            EntityId firstId)
+        {
+            return optionalRunColumn(runColumn(term.table, first, count, firstId), term.table, first, count);
+        }
+
+        template <typename TableType>
+        static NoColumn optionalRunColumn(NoColumn column, const TableType&, uint32_t, uint32_t)
+        {
+            return column;
+        }
+
+        template <typename Component, typename TableType>
+        static RunColumn<Component> optionalRunColumn(
+            RunColumn<Component> column,
+            const TableType& table,
+            uint32_t first,
+            uint32_t count)
+        {
+            if (column.contiguous)
+            {
+                return column;
+            }
+
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                if (table.index().check(first + i))
+                {
+                    return column;
+                }
+            }
+
+            return { nullptr, true };
+        }
+
+        // Return the span arguments of a column for a run of entities.
+        template <typename Component>
+        static std::tuple<Span<Component>> runArguments(const RunColumn<Component>& column, uint32_t count)
+        {
+            return std::make_tuple(column.data ? Span<Component>(column.data, count) : Span<Component>());
+        }
+
+        static std::tuple<> runArguments(const NoColumn&, uint32_t)
+        {
+            return std::tuple<>();
+        }
+
+        // Execute a function for a run of 'count' entities starting from entity
+        // index 'first'. Return false if the components of the run are not
+        // stored contiguously in all tables.
+        template <typename F, size_t... Is>
+        bool executeRun(F& f, uint32_t first, uint32_t count, uint64_t mask, std::index_sequence<Is...>)
+        {
+            auto columns = std::make_tuple(
+                runColumn(std::get<Is>(m_tables), first, count, m_database.entity(first))...);
+
+            bool contiguous = true;
+            doInOrder([&] { contiguous = contiguous && std::get<Is>(columns).contiguous; }...);
+
+            if (!contiguous)
+            {
+                return false;
+            }
+
+            EntityId ids[QueryChunk::k_maxSize];
+            for (uint32_t i = 0; i < count; ++i)
+            {
+                ids[i] = m_database.entity(first + i);
+            }
+
+            QueryChunk chunk = { Span<const EntityId>(ids, count), mask };
+
+            apply(f, std::tuple_cat(
+                std::forward_as_tuple(chunk),
+                runArguments(std::get<Is>(columns), count)...));
+
+            return true;
+        }
+
+        // Execute a function for the matches of a block of entities, which
+        // starts from entity index 'first' and has 'bits' set for each match.
+        template <typename F>
+        void executeRuns(F& f, uint32_t first, uint64_t bits)
+        {
+            const auto sequence = std::index_sequence_for<Tables...>();
+
+            // Try a single run from the first to the last match of the block
+            const uint32_t lowest = bits::countTrailingZeros(bits);
+            const uint32_t highest = 63u - bits::countLeadingZeros(bits);
+
+            if (executeRun(f, first + lowest, highest - lowest + 1u, bits >> lowest, sequence))
+            {
+                return;
+            }
+
+            // Otherwise split into runs of consecutive matches, and
+            // further into single entities if still not contiguous
+            while (bits != 0u)
+            {
+                const uint32_t start = bits::countTrailingZeros(bits);
+                const uint64_t shifted = ~(bits >> start);
+                const uint32_t count = shifted == 0u ? 64u - start : bits::countTrailingZeros(shifted);
+                const uint64_t run = QueryChunk::fullMask(count);
+
+                if (!executeRun(f, first + start, count, run, sequence))
+                {
+                    for (uint32_t i = 0; i < count; ++i)
+                    {
+                        const bool executed = executeRun(f, first + start + i, 1u, 1u, sequence);
+                        assert(executed && "Single entities are always contiguous");
+                        (void) executed;
+                    }
+                }
+
+                bits &= ~(run << start);
+            }
+        }
+
+        // Return the span arguments of an archetype column for a run of rows.
+        // Tags pass no span, as with table storage.
+        template <typename Component>
+        using is_tag = std::is_base_of<ITag, std::remove_const_t<Component>>;
+
+        template <typename Component>
+        static auto archetypeRunArguments(Component* column, uint32_t row, uint32_t count)
+        {
+            return archetypeRunArguments(column, row, count, is_tag<Component>());
+        }
+
+        template <typename Component>
+        static auto archetypeRunArguments(OptionalColumn<Component> column, uint32_t row, uint32_t count)
+        {
+            return archetypeRunArguments(column.data, row, count, is_tag<Component>());
+        }
+
+        template <typename Component>
+        static std::tuple<Span<Component>> archetypeRunArguments(Component* column, uint32_t row, uint32_t count, std::false_type)
+        {
+            return std::make_tuple(column ? Span<Component>(column + row, count) : Span<Component>());
+        }
+
+        template <typename Component>
+        static std::tuple<> archetypeRunArguments(Component*, uint32_t, uint32_t, std::true_type)
+        {
+            return std::tuple<>();
+        }
+
+        static std::tuple<> archetypeRunArguments(std::nullptr_t, uint32_t, uint32_t)
+        {
+            return std::tuple<>();
+        }
+
+        template <typename TableType>
+        static std::tuple<> archetypeRunArguments(TagColumn<TableType>, uint32_t, uint32_t)
+        {
+            return std::tuple<>();
+        }
+
+        template <typename TableType>
+        static std::tuple<> archetypeRunArguments(OptionalTagColumn<TableType>, uint32_t, uint32_t)
+        {
+            return std::tuple<>();
+        }
+
+        // Execute a function for runs of rows of an archetype chunk, which are
+        // dense unless the query has tag or changedSince() terms.
+        template <typename F, size_t... Is>
+        void executeArchetypeRuns(F& f, const Archetype& archetype, size_t chunk, std::index_sequence<Is...>)
+        {
+            const EntityId* ids = archetype.ids(chunk);
+            const uint32_t count = archetype.entityCount(chunk);
+
+            auto columns = std::make_tuple(
+                archetypeColumn(std::get<Is>(m_tables), archetype, chunk)...);
+
+            for (uint32_t row = 0; row < count; row += QueryChunk::k_maxSize)
+            {
+                const uint32_t size = count - row < QueryChunk::k_maxSize ? count - row : QueryChunk::k_maxSize;
+
+                QueryChunk run = { Span<const EntityId>(ids + row, size), QueryChunk::fullMask(size) };
+
+                if (tagCount() > 0 || changedCount() > 0)
+                {
+                    for (uint32_t i = 0; i < size; ++i)
+                    {
+                        if (!rowMatches(run.ids[i]))
+                        {
+                            run.mask &= ~(uint64_t(1) << i);
+                        }
+                    }
+
+                    if (run.mask == 0u)
+                    {
+                        continue;
+                    }
+                }
+
+                apply(f, std::tuple_cat(
+                    std::forward_as_tuple(run),
+                    archetypeRunArguments(std::get<Is>(columns), row, size)...));
+            }
+        }
+
+        // Return the query function arguments of a filter term for an entity.
+        template <typename Table>
+        static auto arguments(EntityId id, Table& table)
+        {
+            assert(table[id] != nullptr && "Entity doesn't have component");
+            return std::forward_as_tuple(*table[id]);
+        }
+
+        template <typename TableRef>
+        static auto arguments(EntityId id, OptionalTable<TableRef>& term)
+        {
+            return std::make_tuple(term.table[id]);
+        }
+
+        template <typename TableRef>
+        static std::tuple<> arguments(EntityId, ExcludedTable<TableRef>&)
+        {
+            return std::tuple<>();
+        }
+
+        template <typename... TableRefs>
+        static std::tuple<> arguments(EntityId, ChangedTable<TableRefs...>&)
+        {
+            return std::tuple<>();
+        }
+
+        // Call a function with the elements of a tuple as its arguments.
+        template <typename F, typename Tuple>
+        static void apply(F& f, Tuple&& args)
+        {
+            applyImpl(f, std::forward<Tuple>(args),
+                std::make_index_sequence<std::tuple_size<std::decay_t<Tuple>>::value>());
+        }
+
+        template <typename F, typename Tuple, size_t... Is>
+        static void applyImpl(F& f, Tuple&& args, std::index_sequence<Is...>)
+        {
+            f(std::get<Is>(std::forward<Tuple>(args))...);
+        }
+
+        template <typename F, size_t... Is>
+        void processImpl(EntityId id, F&& f, std::index_sequence<Is...>)
+        {
+            apply(f, std::tuple_cat(
+                std::make_tuple(id),
+                arguments(id, std::get<Is>(m_tables))...));
+        }
+
+    private:
+        // Entity index of an iterator past the last match
+        static constexpr uint32_t k_noMatch = std::numeric_limits<uint32_t>::max();
+        // Cost of a random memory access relative to a sequential word operation
+        static constexpr size_t k_probeCost = 4u;
+
+        const Database& m_database;
+
+        std::tuple<Tables...> m_tables;
+
+        // Signatures which probed entities are matched against
+        Signature m_mask;
+        Signature m_excluded;
+        // Signature bits of the tag tables among the required and excluded tables
+        Signature m_tags;
+
+        // Plan of the current execution
+        QueryPlan m_plan;
+
+#ifndef NDEBUG
+        QueryStats m_stats;
+#endif
+    };
+
+    template <typename... Tables>
+    constexpr uint32_t Query<Tables...>::k_noMatch;
+    template <typename... Tables>
+    constexpr size_t Query<Tables...>::k_probeCost;
 
     // Build a query with read-only access to database.
     Query<> query(const Database& database);
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <core/ecs/EntityId.hpp>
+
+#include <algorithm>
+#include <vector>
+
+namespace eng
+{
+    template <typename... Tables>
+    class Query;
+
+    // Matching entity ids of a query, kept between query executions. The ids
+    // are recomputed only when the structural version of one of the query's
+    // tables has changed, so that a query over tables without added or
+    // removed components does no intersection work. A cache can be shared
+    // by queries with the same required and excluded tables.
+    class QueryCache
+    {
+    public:
+        // Return the cached ids, which may be out of date.
+        const std::vector<EntityId>& ids() const { return m_ids; }
+
+        // Number of times the cached ids have been recomputed.
+        size_t rebuildCount() const { return m_rebuildCount; }
+
+        // Force the ids to be recomputed on the next query execution.
+        void invalidate() { m_versions.clear(); }
+
+    private:
+        template <typename... Tables>
+        friend class Query;
+
+        struct TableVersion
+        {
+            const void* table;
+            uint64_t version;
+            // True if entities with the component are excluded from matches
+            bool excluded;
+        };
+
+        // Return true if the cached ids were computed from these table versions.
+        bool current(const TableVersion* versions, size_t count) const;
+        // Clear the cached ids, to be recomputed for the given table versions.
+        std::vector<EntityId>& rebuild(const TableVersion* versions, size_t count);
+
+    private:
+        std::vector<EntityId> m_ids;
+        std::vector<TableVersion> m_versions;
+
+        size_t m_rebuildCount = 0u;
+    };
+
+    inline bool QueryCache::current(const TableVersion* versions, size_t count) const
+    {
+        if (m_versions.empty() || m_versions.size() != count)
+        {
+            return false;
+        }
+
+        return std::equal(m_versions.begin(), m_versions.end(), versions,
+            [](const TableVersion& lhs, const TableVersion& rhs)
+        {
+            return lhs.table == rhs.table &&
+                lhs.version == rhs.version &&
+                lhs.excluded == rhs.excluded;
+        });
+    }
+
+    inline std::vector<EntityId>& QueryCache::rebuild(const TableVersion* versions, size_t count)
+    {
+        m_versions.assign(versions, versions + count);
+        m_ids.clear();
+        m_rebuildCount++;
+
+        return m_ids;
+    }
+}
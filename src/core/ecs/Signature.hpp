@@ -0,0 +1,13 @@
+#pragma once
+
+#include <bitset>
+
+namespace eng
+{
+    // Maximum number of component tables in a single database.
+    constexpr unsigned k_maxComponents = 64;
+
+    // Bitmask describing a set of component types, where each component
+    // table of a database is associated with one bit.
+    using Signature = std::bitset<k_maxComponents>;
+}
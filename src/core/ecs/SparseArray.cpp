@@ -0,0 +1,73 @@
+#include <Precompiled.hpp>
+#include <core/ecs/SparseArray.hpp>
+
+using namespace eng;
+
+constexpr uint32_t SparseArray::k_invalid;
+
+void SparseArray::set(EntityId id, uint32_t value)
+{
+    assert(value != k_invalid && "Cannot set reserved value");
+
+    size_t page = id >> k_pageBits;
+
+    if (page >= m_pages.size())
+    {
+        m_pages.resize(page + 1);
+    }
+
+    if (!m_pages[page])
+    {
+        m_pages[page] = std::make_unique<Page>();
+        m_pages[page]->values.fill(k_invalid);
+        m_pages[page]->count = 0u;
+        m_pageCount++;
+    }
+
+    uint32_t& slot = m_pages[page]->values[id & k_pageMask];
+    if (slot == k_invalid)
+    {
+        m_pages[page]->count++;
+    }
+    slot = value;
+}
+
+void SparseArray::erase(EntityId id)
+{
+    size_t page = id >> k_pageBits;
+    if (page >= m_pages.size() || !m_pages[page])
+    {
+        return;
+    }
+
+    uint32_t& slot = m_pages[page]->values[id & k_pageMask];
+    if (slot == k_invalid)
+    {
+        return;
+    }
+
+    slot = k_invalid;
+
+    if (--m_pages[page]->count == 0u)
+    {
+        // Release empty pages to keep memory bounded
+        m_pages[page].reset();
+        m_pageCount--;
+    }
+}
+
+void SparseArray::clear()
+{
+    m_pages.clear();
+    m_pageCount = 0u;
+}
+
+size_t SparseArray::pageCount() const
+{
+    return m_pageCount;
+}
+
+size_t SparseArray::memoryUsage() const
+{
+    return m_pages.capacity() * sizeof(std::unique_ptr<Page>) + m_pageCount * sizeof(Page);
+}
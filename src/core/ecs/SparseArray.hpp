@@ -0,0 +1,67 @@
+#pragma once
+
+#include <core/ecs/EntityId.hpp>
+
+#include <array>
+#include <limits>
+#include <memory>
+#include <vector>
+
+namespace eng
+{
+    // Paged sparse array which maps entity ids to dense indices.
+    // Lookups are O(1) without hashing. Pages of fixed size are allocated
+    // on demand and released once empty, so memory stays bounded by the
+    // number of populated id ranges rather than by the highest id.
+    class SparseArray
+    {
+    public:
+        static constexpr uint32_t k_invalid = std::numeric_limits<uint32_t>::max();
+
+    public:
+        void set(EntityId id, uint32_t value);
+        void erase(EntityId id);
+        void clear();
+
+        // Return value mapped to id, or k_invalid if none.
+        uint32_t get(EntityId id) const;
+        bool check(EntityId id) const;
+
+        // Number of currently allocated pages.
+        size_t pageCount() const;
+        // Return number of bytes allocated by the array.
+        size_t memoryUsage() const;
+
+    private:
+        static constexpr unsigned k_pageBits = 10;
+        static constexpr unsigned k_pageSize = 1u << k_pageBits;
+        static constexpr unsigned k_pageMask = k_pageSize - 1;
+
+        struct Page
+        {
+            std::array<uint32_t, k_pageSize> values;
+            // Number of valid values in the page
+            uint32_t count;
+        };
+
+    private:
+        std::vector<std::unique_ptr<Page>> m_pages;
+        size_t m_pageCount = 0u;
+    };
+
+    inline uint32_t SparseArray::get(EntityId id) const
+    {
+        size_t page = id >> k_pageBits;
+        if (page >= m_pages.size() || !m_pages[page])
+        {
+            return k_invalid;
+        }
+
+        return m_pages[page]->values[id & k_pageMask];
+    }
+
+    inline bool SparseArray::check(EntityId id) const
+    {
+        return get(id) != k_invalid;
+    }
+}
@@ -1,26 +1,57 @@
 #include <Precompiled.hpp>
 #include <core/ecs/SparseIndex.hpp>
 
+#include <core/Bits.hpp>
+#include <core/Simd.hpp>
+
+#include <algorithm>
+
 using namespace eng;
 
 namespace
 {
-    size_t skipEmptyBits(
-        const SparseIndex& index,
-        size_t from,
-        size_t size)
+    // Summary words with at least this many non-empty blocks are processed
+    // with bulk kernels over all of their blocks, instead of block by block.
+    constexpr unsigned k_denseSummaryBits = 16;
+
+    // Execute 'bulk' for the range of blocks [first, first + count) covered by each
+    // dense summary word, and 'single' for each non-empty block of sparse summary
+    // words. Only blocks before 'blockCount' are visited.
+    template <typename Bulk, typename Single>
+    void forEachBlockRange(
+        const std::vector<uint64_t>& summary,
+        size_t blockCount,
+        Bulk&& bulk,
+        Single&& single)
     {
-        while (!index.check(static_cast<EntityId>(from)))
+        for (size_t word = 0; word < summary.size() && word * 64u < blockCount; ++word)
         {
-            if (from >= size)
+            uint64_t bits = summary[word];
+            if (bits == 0u)
             {
-                break;
+                continue;
             }
 
-            ++from;
-        }
+            const size_t first = word * 64u;
+
+            if (bits::popCount(bits) >= k_denseSummaryBits)
+            {
+                bulk(first, (std::min)(size_t(64u), blockCount - first));
+                continue;
+            }
 
-        return from;
+            while (bits != 0u)
+            {
+                const size_t index = first + bits::countTrailingZeros(bits);
+                if (index >= blockCount)
+                {
+                    break;
+                }
+
+                single(index);
+                bits &= bits - 1u;
+            }
+        }
     }
 }
 
@@ -38,12 +69,46 @@ void SparseIndex::insert(EntityId id)
 {
     auto pos = bitPos(id);
 
-    while (pos.index >= m_bits.size())
+    if (pos.index >= m_bits.size())
     {
-        allocateBlock();
+        allocateBlocks(pos.index + 1);
     }
 
-    m_bits[pos.index].set(pos.bit);
+    const DataBlock bit = DataBlock(1) << pos.bit;
+    if ((m_bits[pos.index] & bit) == 0u)
+    {
+        m_bits[pos.index] |= bit;
+        markBlock(pos.index);
+        ++m_count;
+    }
+}
+
+void SparseIndex::insertRange(EntityId first, uint32_t count)
+{
+    if (count == 0u)
+    {
+        return;
+    }
+
+    auto begin = bitPos(first);
+    auto last = bitPos(first + count - 1);
+
+    if (last.index >= m_bits.size())
+    {
+        allocateBlocks(last.index + 1);
+    }
+
+    for (size_t index = begin.index; index <= last.index; ++index)
+    {
+        unsigned from = index == begin.index ? begin.bit : 0u;
+        unsigned to = index == last.index ? last.bit : k_bitsPerBlock - 1;
+
+        // Set bits [from, to] of the block
+        const DataBlock mask = (~DataBlock(0) >> (k_bitsPerBlock - 1 - to)) & (~DataBlock(0) << from);
+        m_count += bits::popCount(mask & ~m_bits[index]);
+        m_bits[index] |= mask;
+        markBlock(index);
+    }
 }
 
 void SparseIndex::erase(EntityId id)
@@ -55,12 +120,20 @@ void SparseIndex::erase(EntityId id)
         return;
     }
 
-    m_bits[pos.index].reset(pos.bit);
+    const DataBlock bit = DataBlock(1) << pos.bit;
+    if ((m_bits[pos.index] & bit) != 0u)
+    {
+        m_bits[pos.index] &= ~bit;
+        updateBlock(pos.index);
+        --m_count;
+    }
 }
 
 void SparseIndex::clear()
 {
     m_bits.clear();
+    m_summary.clear();
+    m_count = 0u;
 }
 
 bool SparseIndex::check(EntityId id) const
@@ -72,47 +145,39 @@ bool SparseIndex::check(EntityId id) const
         return false;
     }
 
-    return m_bits[pos.index][pos.bit];
+    return (m_bits[pos.index] >> pos.bit) & 1u;
 }
 
-size_t SparseIndex::size() const
+size_t SparseIndex::memoryUsage() const
 {
-    size_t count = 0;
-
-    for (auto& bitset : m_bits)
-    {
-        count += bitset.count();
-    }
-
-    return count;
-}
-
-bool SparseIndex::empty() const
-{
-    return size() == 0u;
+    return (m_bits.capacity() + m_summary.capacity()) * sizeof(DataBlock);
 }
 
 SparseIndex& SparseIndex::operator|=(const SparseIndex& other)
 {
-    size_t otherSize = other.m_bits.size();
-    while (otherSize > m_bits.size())
+    if (other.m_bits.size() > m_bits.size())
     {
         // Ensure we have enough blocks for ORing against other
-        allocateBlock();
+        allocateBlocks(other.m_bits.size());
     }
 
-    size_t thisSize = m_bits.size();
-    size_t maxSize = (std::max)(thisSize, otherSize);
-
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        if (i >= otherSize)
+    // Only non-empty blocks of other can change our bits
+    forEachBlockRange(other.m_summary, other.m_bits.size(),
+        [&](size_t first, size_t count)
         {
-            // Other has no more bits to OR
-            break;
-        }
+            m_count -= simd::popCount(&m_bits[first], count);
+            simd::orBlocks(&m_bits[first], &other.m_bits[first], count);
+            m_count += simd::popCount(&m_bits[first], count);
+        },
+        [&](size_t index)
+        {
+            m_count += bits::popCount(other.m_bits[index] & ~m_bits[index]);
+            m_bits[index] |= other.m_bits[index];
+        });
 
-        m_bits[i] |= other.m_bits[i];
+    for (size_t i = 0; i < other.m_summary.size(); ++i)
+    {
+        m_summary[i] |= other.m_summary[i];
     }
 
     return *this;
@@ -120,78 +185,206 @@ SparseIndex& SparseIndex::operator|=(const SparseIndex& other)
 
 SparseIndex& SparseIndex::operator&=(const SparseIndex& other)
 {
-    size_t thisSize = m_bits.size();
-    size_t otherSize = other.m_bits.size();
-    size_t maxSize = (std::max)(thisSize, otherSize);
+    const size_t shared = (std::min)(m_bits.size(), other.m_bits.size());
 
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        if (i >= thisSize)
+    // Only our non-empty blocks can remain non-empty
+    forEachBlockRange(m_summary, m_bits.size(),
+        [&](size_t first, size_t count)
         {
-            // We have no more bits to AND
-            break;
-        }
+            const size_t andCount = first < shared ? (std::min)(count, shared - first) : 0u;
 
-        if (i >= otherSize)
-        {
-            // Other has no more bits, reset our 
+            m_count -= simd::popCount(&m_bits[first], count);
+            if (andCount > 0u)
+            {
+                simd::andBlocks(&m_bits[first], &other.m_bits[first], andCount);
+            }
+
+            // Other has no more bits, reset our
             // remaining bits because we're ANDing
-            m_bits[i].reset();
-        }
-        else
+            std::fill(
+                m_bits.begin() + (first + andCount),
+                m_bits.begin() + (first + count),
+                DataBlock(0));
+            m_count += simd::popCount(&m_bits[first], andCount);
+
+            updateSummary(first / k_bitsPerBlock);
+        },
+        [&](size_t index)
         {
-            m_bits[i] &= other.m_bits[i];
-        }
-    }
+            const DataBlock block = index < shared ? m_bits[index] & other.m_bits[index] : DataBlock(0);
+            m_count -= bits::popCount(m_bits[index] ^ block);
+            m_bits[index] = block;
+            updateBlock(index);
+        });
 
     return *this;
 }
 
 SparseIndex& SparseIndex::operator^=(const SparseIndex& other)
 {
-    size_t otherSize = other.m_bits.size();
-    while (otherSize > m_bits.size())
+    if (other.m_bits.size() > m_bits.size())
     {
         // Ensure we have enough blocks for XORing against other
-        allocateBlock();
+        allocateBlocks(other.m_bits.size());
     }
 
-    size_t thisSize = m_bits.size();
-    size_t maxSize = (std::max)(thisSize, otherSize);
+    // Empty blocks of other leave our bits unchanged
+    forEachBlockRange(other.m_summary, other.m_bits.size(),
+        [&](size_t first, size_t count)
+        {
+            m_count -= simd::popCount(&m_bits[first], count);
+            simd::xorBlocks(&m_bits[first], &other.m_bits[first], count);
+            m_count += simd::popCount(&m_bits[first], count);
+            updateSummary(first / k_bitsPerBlock);
+        },
+        [&](size_t index)
+        {
+            m_count -= bits::popCount(m_bits[index]);
+            m_bits[index] ^= other.m_bits[index];
+            m_count += bits::popCount(m_bits[index]);
+            updateBlock(index);
+        });
 
-    bool otherHasNoMoreBits = false;
+    return *this;
+}
 
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        if (i >= otherSize)
+SparseIndex& SparseIndex::subtract(const SparseIndex& other)
+{
+    // Only our non-empty blocks which other also has can change
+    forEachBlockRange(m_summary, (std::min)(m_bits.size(), other.m_bits.size()),
+        [&](size_t first, size_t count)
         {
-            otherHasNoMoreBits = true;
-        }
-
-        if (otherHasNoMoreBits)
+            m_count -= simd::popCount(&m_bits[first], count);
+            simd::andNotBlocks(&m_bits[first], &other.m_bits[first], count);
+            m_count += simd::popCount(&m_bits[first], count);
+            updateSummary(first / k_bitsPerBlock);
+        },
+        [&](size_t index)
         {
-            // Other has no more bits, so XOR our 
-            // remaining bits against empty bits
-            m_bits[i] ^= DataBlock();
-        }
-        else
+            m_count -= bits::popCount(m_bits[index] & other.m_bits[index]);
+            m_bits[index] &= ~other.m_bits[index];
+            updateBlock(index);
+        });
+
+    return *this;
+}
+
+SparseIndex SparseIndex::intersection(const SparseIndex* const* indices, size_t count)
+{
+    return intersection(indices, count, nullptr, 0u);
+}
+
+SparseIndex SparseIndex::intersection(
+    const SparseIndex* const* indices, size_t count,
+    const SparseIndex* const* excluded, size_t excludedCount)
+{
+    SparseIndex out;
+
+    // Blocks are only allocated up to the last match
+    forEachBlockIntersection(indices, count, excluded, excludedCount, [&](size_t block, DataBlock bits)
+    {
+        if (block >= out.m_bits.size())
         {
-            m_bits[i] ^= other.m_bits[i];
+            out.allocateBlocks(block + 1);
         }
+
+        out.m_bits[block] = bits;
+        out.markBlock(block);
+        out.m_count += bits::popCount(bits);
+    });
+
+    return out;
+}
+
+void SparseIndex::allocateBlocks(size_t count)
+{
+    m_bits.resize(count, DataBlock(0));
+    m_summary.resize((count + k_bitsPerBlock - 1) / k_bitsPerBlock, DataBlock(0));
+}
+
+void SparseIndex::markBlock(size_t index)
+{
+    m_summary[index / k_bitsPerBlock] |= DataBlock(1) << (index % k_bitsPerBlock);
+}
+
+void SparseIndex::updateSummary(size_t word)
+{
+    const size_t first = word * k_bitsPerBlock;
+    const size_t last = (std::min)(first + k_bitsPerBlock, m_bits.size());
+
+    DataBlock summary = 0u;
+    for (size_t index = first; index < last; ++index)
+    {
+        summary |= DataBlock(m_bits[index] != 0u) << (index - first);
     }
 
-    return *this;
+    m_summary[word] = summary;
 }
 
-void SparseIndex::allocateBlock()
+void SparseIndex::updateBlock(size_t index)
 {
-    m_bits.emplace_back(DataBlock());
+    DataBlock bit = DataBlock(1) << (index % k_bitsPerBlock);
+
+    if (m_bits[index] != 0u)
+    {
+        m_summary[index / k_bitsPerBlock] |= bit;
+    }
+    else
+    {
+        m_summary[index / k_bitsPerBlock] &= ~bit;
+    }
+}
+
+size_t SparseIndex::nextSetBit(size_t from, size_t size) const
+{
+    // Blocks may have been released while iterating, never read past them
+    const size_t blockCount = (std::min)(m_bits.size(), size / k_bitsPerBlock);
+
+    size_t index = from / k_bitsPerBlock;
+    if (index >= blockCount)
+    {
+        return size;
+    }
+
+    // Mask out bits before 'from' in the current block
+    DataBlock block = m_bits[index] & (~DataBlock(0) << (from % k_bitsPerBlock));
+    if (block != 0u)
+    {
+        return index * k_bitsPerBlock + bits::countTrailingZeros(block);
+    }
+
+    // Find next non-empty block from the summary, skipping
+    // a whole summary word of empty blocks at a time
+    size_t next = index + 1;
+    size_t word = next / k_bitsPerBlock;
+    if (word >= m_summary.size())
+    {
+        return size;
+    }
+
+    DataBlock summary = m_summary[word] & (~DataBlock(0) << (next % k_bitsPerBlock));
+    while (summary == 0u)
+    {
+        if (++word >= m_summary.size())
+        {
+            return size;
+        }
+        summary = m_summary[word];
+    }
+
+    index = word * k_bitsPerBlock + bits::countTrailingZeros(summary);
+    if (index >= blockCount)
+    {
+        return size;
+    }
+
+    return index * k_bitsPerBlock + bits::countTrailingZeros(m_bits[index]);
 }
 
 SparseIndex::Iterator SparseIndex::begin() const
 {
     size_t size = m_bits.size() * k_bitsPerBlock;
-    size_t pos = skipEmptyBits(*this, 0u, size);
+    size_t pos = nextSetBit(0u, size);
 
     return Iterator(*this, size, pos);
 }
@@ -203,9 +396,17 @@ SparseIndex::Iterator SparseIndex::end() const
     return Iterator(*this, size, size);
 }
 
+SparseIndex::Iterator SparseIndex::lowerBound(EntityId id) const
+{
+    size_t size = m_bits.size() * k_bitsPerBlock;
+    size_t pos = nextSetBit(id, size);
+
+    return Iterator(*this, size, pos);
+}
+
 SparseIndex::Iterator& SparseIndex::Iterator::operator++()
 {
-    m_pos = skipEmptyBits(m_container, ++m_pos, m_size);
+    m_pos = m_container.nextSetBit(m_pos + 1, m_size);
     return *this;
 }
 
@@ -233,92 +434,21 @@ SparseIndex::Iterator::reference SparseIndex::Iterator::operator*() const
 
 eng::SparseIndex eng::operator|(const SparseIndex& lhs, const SparseIndex& rhs)
 {
-    // TODO: Share code with member operator overload
-
-    SparseIndex out;
-    size_t lhsSize = lhs.m_bits.size();
-    size_t rhsSize = rhs.m_bits.size();
-    size_t maxSize = (std::max)(lhsSize, rhsSize);
-
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        out.allocateBlock();
-
-        if (i >= lhsSize)
-        {
-            out.m_bits[i] = rhs.m_bits[i];
-        }
-        else if (i >= rhsSize)
-        {
-            out.m_bits[i] = lhs.m_bits[i];
-        }
-        else
-        {
-            out.m_bits[i] = lhs.m_bits[i] | rhs.m_bits[i];
-        }
-    }
-
+    SparseIndex out = lhs;
+    out |= rhs;
     return out;
 }
 
 eng::SparseIndex eng::operator&(const SparseIndex& lhs, const SparseIndex& rhs)
 {
-    // TODO: Share code with member operator overload
-
-    SparseIndex out;
-    size_t lhsSize = lhs.m_bits.size();
-    size_t rhsSize = rhs.m_bits.size();
-    size_t maxSize = (std::max)(lhsSize, rhsSize);
-
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        out.allocateBlock();
-
-        if (i >= lhsSize)
-        {
-            break;
-        }
-        else if (i >= rhsSize)
-        {
-            break;
-        }
-        else
-        {
-            out.m_bits[i] = lhs.m_bits[i] & rhs.m_bits[i];
-        }
-    }
-
+    SparseIndex out = lhs;
+    out &= rhs;
     return out;
 }
 
 eng::SparseIndex eng::operator^(const SparseIndex& lhs, const SparseIndex& rhs)
 {
-    // TODO: Share code with member operator overload
-
-    constexpr auto emptyBits = SparseIndex::DataBlock();
-
-    SparseIndex out;
-    size_t lhsSize = lhs.m_bits.size();
-    size_t rhsSize = rhs.m_bits.size();
-    size_t maxSize = (std::max)(lhsSize, rhsSize);
-
-    for (size_t i = 0; i < maxSize; ++i)
-    {
-        out.allocateBlock();
-
-        if (i >= lhsSize)
-        {
-            out.m_bits[i] = emptyBits ^ rhs.m_bits[i];
-        }
-        else if (i >= rhsSize)
-        {
-            out.m_bits[i] = lhs.m_bits[i] ^ emptyBits;
-        }
-        else
-        {
-            out.m_bits[i] = lhs.m_bits[i] ^ rhs.m_bits[i];
-        }
-    }
-
+    SparseIndex out = lhs;
+    out ^= rhs;
     return out;
-}
\ No newline at end of file
+}
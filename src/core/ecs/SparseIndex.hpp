@@ -1,9 +1,11 @@
 #pragma once
 
+#include <core/Bits.hpp>
 #include <core/ecs/EntityId.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
-#include <bitset>
 #include <limits>
 
 namespace eng
@@ -13,22 +15,62 @@ namespace eng
     {
     public:
         void insert(EntityId id);
+        // Insert 'count' consecutive ids starting from 'first', a whole block at a time.
+        void insertRange(EntityId first, uint32_t count);
         void erase(EntityId id);
         void clear();
 
         bool check(EntityId id) const;
 
+        // Return number of ids in the index. Maintained incrementally, so this is O(1).
         size_t size() const;
         bool empty() const;
+        // Return true if the index contains any id.
+        bool any() const;
+
+        // Return number of bytes allocated by the index.
+        size_t memoryUsage() const;
+
+        // Return number of 64-id blocks spanned by the index.
+        size_t blockCount() const;
+        // Execute function for each id within blocks [firstBlock, lastBlock),
+        // in ascending order. Disjoint block ranges can be iterated concurrently.
+        template <typename F>
+        void forEachInBlocks(size_t firstBlock, size_t lastBlock, F&& f) const;
+        // Execute function for each non-empty block, called with the first id
+        // of the block and the bits of the block, lowest id in the lowest bit.
+        template <typename F>
+        void forEachBlock(F&& f) const;
 
         SparseIndex& operator|=(const SparseIndex& other);
         SparseIndex& operator&=(const SparseIndex& other);
         SparseIndex& operator^=(const SparseIndex& other);
+        // Remove all ids of 'other' from this index.
+        SparseIndex& subtract(const SparseIndex& other);
 
         friend SparseIndex operator|(const SparseIndex& lhs, const SparseIndex& rhs);
         friend SparseIndex operator&(const SparseIndex& lhs, const SparseIndex& rhs);
         friend SparseIndex operator^(const SparseIndex& lhs, const SparseIndex& rhs);
 
+        // Execute function for each id found in all 'count' indices. Streams over
+        // the blocks of all indices at once, stopping at the shortest index,
+        // without building intermediate indices.
+        template <typename F>
+        static void forEachIntersection(const SparseIndex* const* indices, size_t count, F&& f);
+        // As above, but skip ids found in any of the 'excludedCount' excluded
+        // indices, which are masked out of each block as it is intersected.
+        template <typename F>
+        static void forEachIntersection(
+            const SparseIndex* const* indices, size_t count,
+            const SparseIndex* const* excluded, size_t excludedCount,
+            F&& f);
+        // Return intersection of 'count' indices, built in a single pass,
+        // without the ids of the excluded indices.
+        static SparseIndex intersection(const SparseIndex* const* indices, size_t count);
+        static SparseIndex intersection(
+            const SparseIndex* const* indices, size_t count,
+            const SparseIndex* const* excluded, size_t excludedCount);
+
     public:
         class Iterator : public std::iterator<
             std::input_iterator_tag,
@@ -66,6 +108,8 @@ namespace eng
     public:
         Iterator begin() const;
         Iterator end() const;
+        // Return iterator to the first id in the index which is not less than 'id'.
+        Iterator lowerBound(EntityId id) const;
 
     private:
         struct Position
@@ -78,15 +122,182 @@ namespace eng
 
         static Position bitPos(uint32_t pos);
         
-        void allocateBlock();
+        // Grow the index to hold 'count' blocks.
+        void allocateBlocks(size_t count);
+        // Mark block as non-empty in the summary.
+        void markBlock(size_t index);
+        // Update summary bit of a block after its bits were cleared or changed.
+        void updateBlock(size_t index);
+        // Recompute a whole summary word after its blocks were changed in bulk.
+        void updateSummary(size_t word);
+
+        // Execute function for each non-empty block of the intersection of 'count'
+        // indices, with the bits of the excluded indices cleared.
+        template <typename F>
+        static void forEachBlockIntersection(
+            const SparseIndex* const* indices, size_t count,
+            const SparseIndex* const* excluded, size_t excludedCount,
+            F&& f);
+
+        // Return position of the first set bit at or after 'from',
+        // or 'size' if there are no set bits before 'size'.
+        size_t nextSetBit(size_t from, size_t size) const;
 
     private:
         static constexpr unsigned k_bitsPerBlock = 64;
-        using DataBlock = std::bitset<k_bitsPerBlock>;
+        using DataBlock = uint64_t;
 
         std::vector<DataBlock> m_bits;
+        // Summary level of the index: each bit tells whether the corresponding
+        // block in 'm_bits' is non-empty, so one summary word covers 4096 ids.
+        std::vector<DataBlock> m_summary;
+        // Number of set bits in 'm_bits'
+        size_t m_count = 0u;
     };
 
+    inline size_t SparseIndex::size() const
+    {
+        return m_count;
+    }
+
+    inline bool SparseIndex::empty() const
+    {
+        return m_count == 0u;
+    }
+
+    inline bool SparseIndex::any() const
+    {
+        return m_count != 0u;
+    }
+
+    inline size_t SparseIndex::blockCount() const
+    {
+        return m_bits.size();
+    }
+
+    template <typename F>
+    inline void SparseIndex::forEachInBlocks(size_t firstBlock, size_t lastBlock, F&& f) const
+    {
+        lastBlock = (std::min)(lastBlock, m_bits.size());
+
+        for (size_t block = firstBlock; block < lastBlock; ++block)
+        {
+            // Skip over whole summary words of empty blocks
+            if (block % k_bitsPerBlock == 0u && m_summary[block / k_bitsPerBlock] == 0u)
+            {
+                block += k_bitsPerBlock - 1u;
+                continue;
+            }
+
+            DataBlock bits = m_bits[block];
+            while (bits != 0u)
+            {
+                f(static_cast<EntityId>(block * k_bitsPerBlock + bits::countTrailingZeros(bits)));
+                bits &= bits - 1u;
+            }
+        }
+    }
+
+    template <typename F>
+    inline void SparseIndex::forEachBlock(F&& f) const
+    {
+        for (size_t word = 0; word < m_summary.size(); ++word)
+        {
+            DataBlock summary = m_summary[word];
+            while (summary != 0u)
+            {
+                const size_t block = word * k_bitsPerBlock + bits::countTrailingZeros(summary);
+                summary &= summary - 1u;
+
+                if (m_bits[block] != 0u)
+                {
+                    f(static_cast<EntityId>(block * k_bitsPerBlock), m_bits[block]);
+                }
+            }
+        }
+    }
+
+    template <typename F>
+    inline void SparseIndex::forEachIntersection(const SparseIndex* const* indices, size_t count, F&& f)
+    {
+        forEachIntersection(indices, count, nullptr, 0u, std::forward<F>(f));
+    }
+
+    template <typename F>
+    inline void SparseIndex::forEachIntersection(
+        const SparseIndex* const* indices, size_t count,
+        const SparseIndex* const* excluded, size_t excludedCount,
+        F&& f)
+    {
+        forEachBlockIntersection(indices, count, excluded, excludedCount, [&](size_t block, DataBlock bits)
+        {
+            while (bits != 0u)
+            {
+                f(static_cast<EntityId>(block * k_bitsPerBlock + bits::countTrailingZeros(bits)));
+                bits &= bits - 1u;
+            }
+        });
+    }
+
+    template <typename F>
+    inline void SparseIndex::forEachBlockIntersection(
+        const SparseIndex* const* indices, size_t count,
+        const SparseIndex* const* excluded, size_t excludedCount,
+        F&& f)
+    {
+        if (count == 0u)
+        {
+            return;
+        }
+
+        size_t blockCount = indices[0]->m_bits.size();
+        for (size_t i = 1; i < count; ++i)
+        {
+            blockCount = (std::min)(blockCount, indices[i]->m_bits.size());
+        }
+
+        const size_t summaryCount = (blockCount + k_bitsPerBlock - 1) / k_bitsPerBlock;
+
+        for (size_t word = 0; word < summaryCount; ++word)
+        {
+            // Only blocks which are non-empty in all indices can intersect
+            DataBlock summary = indices[0]->m_summary[word];
+            for (size_t i = 1; i < count && summary != 0u; ++i)
+            {
+                summary &= indices[i]->m_summary[word];
+            }
+
+            while (summary != 0u)
+            {
+                const size_t block = word * k_bitsPerBlock + bits::countTrailingZeros(summary);
+                summary &= summary - 1u;
+
+                if (block >= blockCount)
+                {
+                    break;
+                }
+
+                DataBlock bits = indices[0]->m_bits[block];
+                for (size_t i = 1; i < count && bits != 0u; ++i)
+                {
+                    bits &= indices[i]->m_bits[block];
+                }
+                for (size_t i = 0; i < excludedCount && bits != 0u; ++i)
+                {
+                    if (block < excluded[i]->m_bits.size())
+                    {
+                        bits &= ~excluded[i]->m_bits[block];
+                    }
+                }
+
+                if (bits != 0u)
+                {
+                    f(block, bits);
+                }
+            }
+        }
+    }
+
     SparseIndex operator|(const SparseIndex& lhs, const SparseIndex& rhs);
     SparseIndex operator&(const SparseIndex& lhs, const SparseIndex& rhs);
     SparseIndex operator^(const SparseIndex& lhs, const SparseIndex& rhs);
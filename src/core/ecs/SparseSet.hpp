@@ -1,94 +1,124 @@
 #pragma once
 
 #include <core/ecs/EntityId.hpp>
+#include <core/ecs/SparseArray.hpp>
 
 #include <vector>
-#include <bitset>
-#include <limits>
 
 namespace eng
 {
-    // TODO: Fixed size sparse set container. Currently not used, because
-    // of fixed size requirement, but could be faster than SparseIndex.
-    // Test this against SparseIndex i.e. DynamicBitset.
-    // TODO: Add iterator
+    // Set of entity ids stored as a packed dense array of ids, and a paged
+    // sparse array which maps each id to its position in the dense array.
+    // Insert, erase and check are O(1), and iteration walks only the dense
+    // array, in insertion order with removals swapped in from the back.
+    // Compared to SparseIndex, memory and iteration cost scale with the number
+    // of ids rather than the highest id, but intersections must probe each id.
     class SparseSet
     {
-    private:
-        // TODO: Expose resizability
-        static constexpr unsigned k_size = 256;
+    public:
+        using Iterator = std::vector<EntityId>::const_iterator;
 
     public:
-        SparseSet()
+        void insert(EntityId id);
+        // Insert 'count' consecutive ids starting from 'first'.
+        void insertRange(EntityId first, uint32_t count);
+        void erase(EntityId id);
+        void clear();
+
+        bool check(EntityId id) const;
+
+        size_t size() const;
+        bool empty() const;
+        bool any() const;
+
+        // Return number of bytes allocated by the set.
+        size_t memoryUsage() const;
+
+        Iterator begin() const;
+        Iterator end() const;
+
+    private:
+        std::vector<EntityId> m_dense;
+        // Position of each id in 'm_dense'
+        SparseArray m_sparse;
+    };
+
+    inline void SparseSet::insert(EntityId id)
+    {
+        if (m_sparse.check(id))
         {
-            m_sparse.resize(k_size, nullptr);
+            return;
         }
 
-        void insert(EntityId id)
-        {
-            m_dense.emplace_back(id);
-            
-            size_t k = static_cast<size_t>(id);
+        m_sparse.set(id, static_cast<uint32_t>(m_dense.size()));
+        m_dense.emplace_back(id);
+    }
 
-            if (m_sparse.size() <= k)
-            {
-                m_sparse.resize(k, nullptr);
-            }
+    inline void SparseSet::insertRange(EntityId first, uint32_t count)
+    {
+        m_dense.reserve(m_dense.size() + count);
 
-            m_sparse[k] = &m_dense.back();
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            insert(first + i);
         }
+    }
 
-        void erase(EntityId id)
+    inline void SparseSet::erase(EntityId id)
+    {
+        const uint32_t pos = m_sparse.get(id);
+        if (pos == SparseArray::k_invalid)
         {
-            size_t k = static_cast<size_t>(id);
+            return;
+        }
 
-            if (m_sparse.size() <= k)
-            {
-                return;
-            }
+        // Swap last id into the erased position to keep the dense array packed
+        const EntityId last = m_dense.back();
+        m_dense[pos] = last;
+        m_sparse.set(last, pos);
 
-            // Swap last value to erased value
-            *(m_sparse[k]) = m_dense.back();
+        m_dense.pop_back();
+        m_sparse.erase(id);
+    }
 
-            // Update sparse vector
-            m_sparse[m_dense.back()] = m_sparse[k];
-            m_sparse[k] = nullptr;
+    inline void SparseSet::clear()
+    {
+        m_dense.clear();
+        m_sparse.clear();
+    }
 
-            // Remove last value
-            m_dense.erase(m_dense.end() - 1);
-        }
-               
-        void clear()
-        {
-            m_dense.clear();
-            m_sparse.clear();
-            m_sparse.resize(k_size, nullptr);
-        }
+    inline bool SparseSet::check(EntityId id) const
+    {
+        return m_sparse.check(id);
+    }
 
-        bool check(EntityId id) const
-        {
-            size_t k = static_cast<size_t>(id);
+    inline size_t SparseSet::size() const
+    {
+        return m_dense.size();
+    }
 
-            if (m_sparse.size() <= k)
-            {
-                return m_sparse[k] != nullptr;
-            }
+    inline bool SparseSet::empty() const
+    {
+        return m_dense.empty();
+    }
 
-            return false;
-        }
+    inline bool SparseSet::any() const
+    {
+        return !m_dense.empty();
+    }
 
-        size_t size() const
-        {
-            return m_dense.size();
-        }
+    inline size_t SparseSet::memoryUsage() const
+    {
+        return m_dense.capacity() * sizeof(EntityId) + m_sparse.memoryUsage();
+    }
 
-        bool empty() const
-        {
-            return m_dense.empty();
-        }
+    inline SparseSet::Iterator SparseSet::begin() const
+    {
+        return m_dense.begin();
+    }
 
-    private:
-        std::vector<EntityId>  m_dense;
-        std::vector<EntityId*> m_sparse;
-    };
+    inline SparseSet::Iterator SparseSet::end() const
+    {
+        return m_dense.end();
+    }
 }
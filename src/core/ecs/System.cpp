@@ -12,23 +12,13 @@ void System::onRegistered(const Scene& scene)
 
 void System::commitUpdated(Database& db)
 {
-    auto& updated = db.table<Updated>();
-
-    m_updatedTable.forEach([&](EntityId id, Updated&)
-    {
-        updated.assign(id, Updated());
-    });
+    db.table<Updated>().assign(m_updatedTable.index());
     m_updatedTable.clear();
 }
 
 void System::commitDeleted(Database& db)
 {
-    auto& deleted = db.table<Deleted>();
-
-    m_deletedTable.forEach([&](EntityId id, Deleted&)
-    {
-        deleted.assign(id, Deleted());
-    });
+    db.table<Deleted>().assign(m_deletedTable.index());
     m_deletedTable.clear();
 }
 
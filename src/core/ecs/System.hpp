@@ -2,6 +2,7 @@
 
 #include <core/Core.hpp>
 #include <core/ecs/Database.hpp>
+#include <core/ecs/PersistentQuery.hpp>
 #include <core/ecs/Query.hpp>
 #include <core/ecs/Scheduler.hpp>
 
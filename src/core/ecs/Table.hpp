@@ -1,10 +1,25 @@
 #pragma once
 
 #include <core/Core.hpp>
+#include <core/Span.hpp>
+#include <core/ecs/Archetype.hpp>
+#include <core/ecs/IComponent.hpp>
+#include <core/ecs/SparseArray.hpp>
 #include <core/ecs/SparseIndex.hpp>
 
+#include <algorithm>
+
 namespace eng
 {
+    // Result of a table compaction pass.
+    struct CompactionStats
+    {
+        // Number of components moved into entity id order.
+        size_t moved = 0u;
+        // Number of components not yet verified to be in entity id order.
+        size_t remaining = 0u;
+    };
+
     class ITable 
     {
     public:
@@ -13,213 +28,986 @@ namespace eng
         virtual void remove(EntityId id) = 0;
         virtual void clear() = 0;
         virtual bool empty() const = 0;
+
+        // Apply structural changes made since the last sync point to the
+        // component bit of each changed entity's signature.
+        virtual void syncSignatures(std::vector<Signature>& signatures) = 0;
+
+        // Incrementally reorder stored components to match the ascending entity
+        // order of index iteration, until 'timer' exceeds 'budgetMs'.
+        virtual CompactionStats compact(const Timer& timer, double budgetMs) = 0;
     };
 
-    template <typename Component>
+    // Tables of tag components are specialized to store no component data,
+    // see Table<Tag, true> below. 'Index' is the container which tracks the
+    // entities of the table, selected by the component's Index alias:
+    // SparseIndex (default) or SparseSet.
+    template <
+        typename Component,
+        bool IsTag = std::is_base_of<ITag, Component>::value,
+        typename Index = typename Component::Index>
     class Table : public ITable, public trait::non_copyable
     {
     public:
+        using IndexType = Index;
+
         Table() = default;
         ~Table() override = default;
         Table(Table&&) = default;
         Table& operator=(Table&&) = default;
 
         void assign(EntityId id, Component&& component);
+        // Assign components to a batch of entities in one pass, moving from 
+        // 'components'. Storage is reserved once for the whole batch.
+        void assignBatch(EntityRange ids, Span<Component> components);
+        void assignBatch(Span<const EntityId> ids, Span<Component> components);
         void remove(EntityId id) override;
         void clear() override;
         bool empty() const override;
         bool check(EntityId id) const;
         size_t size() const;
 
-        std::vector<EntityId> ids() const;
-        const SparseIndex& index() const;
+        // Contiguous ranges of entity ids and their components, in the same
+        // order. Not available when the components are stored in archetypes.
+        Span<const EntityId> ids() const;
+        Span<Component> components();
+        Span<const Component> components() const;
+        // Return position within components() of the component of entity index
+        // 'first', if the components of all 'count' entities starting from it
+        // are stored consecutively in entity order, or SparseArray::k_invalid.
+        uint32_t contiguousPosition(uint32_t first, uint32_t count) const;
+
+        const Index& index() const;
 
         Component* operator[](EntityId id);
         const Component* operator[](EntityId id) const;
 
-        void forEach(std::function<void(EntityId)> func);
-        void forEach(std::function<void(EntityId)> func) const;
-        void forEach(std::function<void(EntityId, Component&)> func);
-        void forEach(std::function<void(EntityId, Component&)> func) const;
+        // Execute function for each entity in the table, called with
+        // either the entity id, or the entity id and the component.
+        template <typename F>
+        void forEach(F&& func);
+        template <typename F>
+        void forEach(F&& func) const;
+
+        void syncSignatures(std::vector<Signature>& signatures) override;
+        // Return true if all structural changes to the table have been
+        // applied to the entity signatures of its database.
+        bool synced() const;
+
+        // Incremented whenever an entity gains or loses the component.
+        uint64_t structuralVersion() const { return m_structuralVersion; }
+
+        // Record that the component of an entity was written in the current
+        // change tick of the database. Called by systems for the components they change,
+        // e.g. from query functions. Entities are stamped in place, so different
+        // entities can be marked concurrently.
+        void markWritten(EntityId id);
+        // Return the database change tick in which the component of an entity was last
+        // assigned or written, or 0 if never, or if the table has no database.
+        uint32_t writeTick(EntityId id) const;
+
+        CompactionStats compact(const Timer& timer, double budgetMs) override;
+
+        // Signature bit of the table within its database.
+        unsigned componentBit() const { return m_componentBit; }
+        // Archetype storage which holds the components, or nullptr 
+        // if the components are stored within the table.
+        ArchetypeStorage* archetypes() const { return m_archetypes; }
+
+    private:
+        friend class Database;
+
+        void attach(
+            unsigned componentBit,
+            ArchetypeStorage* archetypes,
+            const std::vector<uint16_t>* generations,
+            const uint32_t* changeTick);
+
+        // Stamp the component of an assigned entity with the current change tick.
+        void markAssigned(uint32_t entity);
+
+        template <typename Ids>
+        void assignBatchImpl(const Ids& ids, Span<Component> components);
+        void insertBatch(EntityRange ids);
+        void insertBatch(Span<const EntityId> ids);
+
+        template <typename Self, typename F>
+        static void forEachImpl(Self& self, F& func, std::true_type withComponent);
+        template <typename Self, typename F>
+        static void forEachImpl(Self& self, F& func, std::false_type withComponent);
+
+        CompactionStats compactImpl(const Timer& timer, double budgetMs, std::true_type sortedIndex);
+        CompactionStats compactImpl(const Timer& timer, double budgetMs, std::false_type sortedIndex);
+
+        uint32_t componentIndex(EntityId id) const;
+
+        void swapComponents(uint32_t lhs, uint32_t rhs);
+        // Shrink the compacted range to exclude entities ordered after 'entity'.
+        void invalidateCompaction(uint32_t entity);
+        // Update the compacted range for a component appended for 'entity'.
+        void appendCompaction(uint32_t entity);
 
     private:
         // TODO: Assert no concurrent read & write
 
-        SparseIndex m_index;
-        std::vector<EntityId> m_ids; // TODO: Replace with m_index and operator[]?
+        // Entities are addressed by their index, without the generation, so 
+        // that the index stays compact when entity slots are recycled. Tables
+        // don't validate generations; use Database::valid() for stale handles.
+        Index m_index;
+
+        unsigned m_componentBit = 0u;
+        ArchetypeStorage* m_archetypes = nullptr;
+
+        // Indices of entities which had the component assigned or removed since
+        // the last sync point. Only tracked for tables owned by a database.
+        std::vector<uint32_t> m_structuralChanges;
+        bool m_trackStructuralChanges = false;
+
+        uint64_t m_structuralVersion = 0u;
+
+        // Current change tick of the database, and the tick in which the component
+        // of each entity was last written, indexed by entity index
+        const uint32_t* m_changeTick = nullptr;
+        std::vector<uint32_t> m_writeTicks;
+
+        // Components are kept packed: 'm_ids' and 'm_components' are parallel
+        // arrays without holes, and removal swaps the last element into the
+        // removed slot. 'm_idToComponentIndex' is a paged sparse array indexed
+        // by entity index, which holds the dense position of the entity's component.
+        // These are unused when the components are stored in 'm_archetypes'.
+        std::vector<EntityId> m_ids;
         std::vector<Component> m_components;
-        std::unordered_map<EntityId, size_t> m_idToComponentIndex;
-        std::deque<size_t> m_freeIndices;
-
-        // TODO: Offset based entity component indexing?
-        // * component data is stored sequentially in one large array and indexed 
-        //   by using separate arrays which store offset values to entity indices
-
-        // TODO: Signature based entity component queries?
-        // * each component is associated with a bit flag, up to a fixed maximum number
-        //   of component (e.g. 64 or 128)
-        // * each entity is associated with a bitmask describing the components it has
-        //   note: could force us to use sync points for component assignment and removal
-        // * the query constructs a bitmask, or "signature", for the searched components
-        //   and does a bitwise AND against all entities in order to find matches
+        SparseArray m_idToComponentIndex;
+
+        // Number of leading components which are the table's lowest entities
+        // in ascending order, i.e. already compacted.
+        size_t m_compactedCount = 0u;
     };
 
-    template <typename Component>
-    inline void Table<Component>::assign(EntityId id, Component&& component)
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::assign(EntityId id, Component&& component)
     {
-        size_t insertAt = 0u;
-        if (m_freeIndices.empty())
+        const uint32_t entity = entityIndex(id);
+
+        if (!m_index.check(entity))
+        {
+            m_structuralVersion++;
+
+            if (m_trackStructuralChanges)
+            {
+                m_structuralChanges.emplace_back(entity);
+            }
+        }
+
+        markAssigned(entity);
+
+        if (m_archetypes)
         {
-            insertAt = m_components.size();
+            m_archetypes->assign(id, m_componentBit, &component);
+            m_index.insert(entity);
+            return;
         }
-        else
+
+        uint32_t index = componentIndex(id);
+        if (index != SparseArray::k_invalid)
         {
-            insertAt = m_freeIndices.front();
-            m_freeIndices.pop_front();
+            // Entity already has the component, overwrite it in place
+            m_components[index] = std::forward<Component>(component);
+            return;
         }
 
-        if (insertAt < m_components.size())
+        appendCompaction(entity);
+
+        m_idToComponentIndex.set(entity, static_cast<uint32_t>(m_components.size()));
+        m_ids.emplace_back(id);
+        m_components.emplace_back(std::forward<Component>(component));
+        
+        m_index.insert(entity);
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::assignBatch(EntityRange ids, Span<Component> components)
+    {
+        assignBatchImpl(ids, components);
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::assignBatch(Span<const EntityId> ids, Span<Component> components)
+    {
+        assignBatchImpl(ids, components);
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    template <typename Ids>
+    inline void Table<Component, IsTag, Index>::assignBatchImpl(const Ids& ids, Span<Component> components)
+    {
+        assert(ids.size() == components.size() && "Batch size mismatch");
+
+        if (m_archetypes)
         {
-            m_ids[insertAt] = id;
-            m_components[insertAt] = std::forward<Component>(component);
-            m_idToComponentIndex[id] = insertAt;
+            // Each entity moves between archetypes individually
+            for (size_t i = 0; i < components.size(); ++i)
+            {
+                assign(ids[i], std::move(components[i]));
+            }
+            return;
         }
-        else
+
+        m_ids.reserve(m_ids.size() + components.size());
+        m_components.reserve(m_components.size() + components.size());
+
+        for (size_t i = 0; i < components.size(); ++i)
         {
+            const EntityId id = ids[i];
+
+            markAssigned(entityIndex(id));
+
+            uint32_t index = componentIndex(id);
+            if (index != SparseArray::k_invalid)
+            {
+                m_components[index] = std::move(components[i]);
+                continue;
+            }
+
+            m_structuralVersion++;
+
+            if (m_trackStructuralChanges)
+            {
+                m_structuralChanges.emplace_back(entityIndex(id));
+            }
+
+            appendCompaction(entityIndex(id));
+
+            m_idToComponentIndex.set(entityIndex(id), static_cast<uint32_t>(m_components.size()));
             m_ids.emplace_back(id);
-            m_components.emplace_back(std::forward<Component>(component));
-            m_idToComponentIndex[id] = m_components.size() - 1;
+            m_components.emplace_back(std::move(components[i]));
         }
-        
-        m_index.insert(id);
+
+        insertBatch(ids);
     }
 
-    template <typename Component>
-    inline void Table<Component>::remove(EntityId id)
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::insertBatch(EntityRange ids)
     {
-        auto it = m_idToComponentIndex.find(id);
-        if (it != m_idToComponentIndex.end())
+        m_index.insertRange(entityIndex(ids.first()), ids.size());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::insertBatch(Span<const EntityId> ids)
+    {
+        for (auto id : ids)
         {
-            size_t index = it->second;
+            m_index.insert(entityIndex(id));
+        }
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::remove(EntityId id)
+    {
+        const uint32_t entity = entityIndex(id);
+
+        if (m_index.check(entity))
+        {
+            m_structuralVersion++;
+
+            if (m_trackStructuralChanges)
+            {
+                m_structuralChanges.emplace_back(entity);
+            }
+        }
+
+        if (m_archetypes)
+        {
+            if (m_index.check(entity))
+            {
+                m_archetypes->remove(id, m_componentBit);
+                m_index.erase(entity);
+            }
+            return;
+        }
 
-            m_index.erase(id);
-            m_ids[index] = {};
-            m_components[index] = {};
-            m_idToComponentIndex.erase(id);
+        uint32_t index = componentIndex(id);
+        if (index == SparseArray::k_invalid)
+        {
+            return;
+        }
+
+        // Removal leaves the components before the removed one in order
+        m_compactedCount = (std::min)(m_compactedCount, static_cast<size_t>(index));
+
+        uint32_t last = static_cast<uint32_t>(m_components.size() - 1);
+        if (index != last)
+        {
+            // Swap last component into the removed slot to keep storage packed
+            EntityId lastId = m_ids[last];
 
-            m_freeIndices.emplace_back(index);
+            m_ids[index] = lastId;
+            m_components[index] = std::move(m_components[last]);
+            m_idToComponentIndex.set(entityIndex(lastId), index);
         }
+
+        m_ids.pop_back();
+        m_components.pop_back();
+        m_idToComponentIndex.erase(entity);
+
+        m_index.erase(entity);
     }
 
-    template <typename Component>
-    inline void Table<Component>::clear()
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::clear()
     {
+        if (m_index.any())
+        {
+            m_structuralVersion++;
+        }
+
+        if (m_trackStructuralChanges)
+        {
+            for (auto entity : m_index)
+            {
+                m_structuralChanges.emplace_back(entity);
+            }
+        }
+
+        if (m_archetypes)
+        {
+            for (auto entity : m_index)
+            {
+                m_archetypes->remove(m_archetypes->entity(entity), m_componentBit);
+            }
+        }
+
         m_index.clear();
         m_ids.clear();
         m_components.clear();
         m_idToComponentIndex.clear();
+        m_compactedCount = 0u;
     }
 
-    template <typename Component>
-    inline bool Table<Component>::empty() const
+    template <typename Component, bool IsTag, typename Index>
+    inline bool Table<Component, IsTag, Index>::empty() const
     {
         return size() == 0u;
     }
 
-    template<typename Component>
-    inline bool Table<Component>::check(EntityId id) const
+    template <typename Component, bool IsTag, typename Index>
+    inline bool Table<Component, IsTag, Index>::check(EntityId id) const
     {
-        return m_idToComponentIndex.count(id) > 0;
+        return m_index.check(entityIndex(id));
     }
 
-    template <typename Component>
-    inline size_t Table<Component>::size() const
+    template <typename Component, bool IsTag, typename Index>
+    inline size_t Table<Component, IsTag, Index>::size() const
     {
-        return m_index.size();
+        return m_archetypes ? m_index.size() : m_components.size();
     }
     
-    template<typename Component>
-    inline std::vector<EntityId> Table<Component>::ids() const
+    template <typename Component, bool IsTag, typename Index>
+    inline Span<const EntityId> Table<Component, IsTag, Index>::ids() const
     {
-        std::vector<EntityId> ids;
+        assert(!m_archetypes && "Table components are stored in archetypes");
+
+        return Span<const EntityId>(m_ids.data(), m_ids.size());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline Span<Component> Table<Component, IsTag, Index>::components()
+    {
+        assert(!m_archetypes && "Table components are stored in archetypes");
+
+        return Span<Component>(m_components.data(), m_components.size());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline Span<const Component> Table<Component, IsTag, Index>::components() const
+    {
+        assert(!m_archetypes && "Table components are stored in archetypes");
+
+        return Span<const Component>(m_components.data(), m_components.size());
+    }
 
-        auto it = m_index.begin();
-        while (it != m_index.end())
+    template <typename Component, bool IsTag, typename Index>
+    inline uint32_t Table<Component, IsTag, Index>::contiguousPosition(uint32_t first, uint32_t count) const
+    {
+        assert(!m_archetypes && "Table components are stored in archetypes");
+        assert(count > 0u && "Empty range");
+
+        const uint32_t position = m_idToComponentIndex.get(first);
+        if (position == SparseArray::k_invalid || count == 1u)
         {
-            ids.emplace_back(*it);
-            ++it;
+            return position;
         }
 
-        return ids;
+        // Compacted components are in ascending entity order, so if the first
+        // and last entity are exactly 'count' slots apart within the compacted
+        // range, the slots between them hold the entities between them.
+        const uint32_t last = m_idToComponentIndex.get(first + count - 1u);
+        if (last == SparseArray::k_invalid ||
+            last >= m_compactedCount ||
+            last < position ||
+            last - position != count - 1u)
+        {
+            return SparseArray::k_invalid;
+        }
+
+        return position;
     }
 
-    template<typename Component>
-    inline const SparseIndex& Table<Component>::index() const
+    template <typename Component, bool IsTag, typename Index>
+    inline const Index& Table<Component, IsTag, Index>::index() const
     {
         return m_index;
     }
 
-    template<typename Component>
-    inline Component* Table<Component>::operator[](EntityId id)
+    template <typename Component, bool IsTag, typename Index>
+    inline Component* Table<Component, IsTag, Index>::operator[](EntityId id)
     {
-        auto it = m_idToComponentIndex.find(id);
-        if (it != m_idToComponentIndex.end())
+        if (m_archetypes)
         {
-            return &m_components[it->second];
+            return static_cast<Component*>(m_archetypes->get(id, m_componentBit));
         }
-        else
+
+        uint32_t index = componentIndex(id);
+        return index != SparseArray::k_invalid ? &m_components[index] : nullptr;
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline const Component* Table<Component, IsTag, Index>::operator[](EntityId id) const
+    {
+        if (m_archetypes)
         {
-            return nullptr;
+            return static_cast<const Component*>(m_archetypes->get(id, m_componentBit));
         }
+
+        uint32_t index = componentIndex(id);
+        return index != SparseArray::k_invalid ? &m_components[index] : nullptr;
     }
 
-    template <typename Component>
-    inline const Component* Table<Component>::operator[](EntityId id) const
+    template <typename Component, bool IsTag, typename Index>
+    template <typename F>
+    inline void Table<Component, IsTag, Index>::forEach(F&& func)
+    {
+        forEachImpl(*this, func, std::integral_constant<bool, 
+            trait::is_callable<F, EntityId, Component&>::value>());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    template <typename F>
+    inline void Table<Component, IsTag, Index>::forEach(F&& func) const
     {
-        auto it = m_idToComponentIndex.find(id);
-        if (it != m_idToComponentIndex.end())
+        forEachImpl(*this, func, std::integral_constant<bool, 
+            trait::is_callable<F, EntityId, const Component&>::value>());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    template <typename Self, typename F>
+    inline void Table<Component, IsTag, Index>::forEachImpl(Self& self, F& func, std::true_type)
+    {
+        if (self.m_archetypes)
         {
-            return &m_components[it->second];
+            for (auto entity : self.m_index)
+            {
+                EntityId id = self.m_archetypes->entity(entity);
+                func(id, *self[id]);
+            }
+            return;
         }
-        else
+
+        // Plain loop over the packed arrays, which the compiler can inline
+        const size_t count = self.m_ids.size();
+        for (size_t i = 0; i < count; ++i)
         {
-            return nullptr;
+            func(self.m_ids[i], self.m_components[i]);
         }
     }
 
-    template <typename Component>
-    inline void Table<Component>::forEach(std::function<void(EntityId)> func)
+    template <typename Component, bool IsTag, typename Index>
+    template <typename Self, typename F>
+    inline void Table<Component, IsTag, Index>::forEachImpl(Self& self, F& func, std::false_type)
     {
-        for (size_t i = 0; i < m_ids.size(); ++i)
+        if (self.m_archetypes)
         {
-            func(m_ids[i]);
+            for (auto entity : self.m_index)
+            {
+                func(self.m_archetypes->entity(entity));
+            }
+            return;
+        }
+
+        const size_t count = self.m_ids.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            func(self.m_ids[i]);
         }
     }
 
-    template <typename Component>
-    inline void Table<Component>::forEach(std::function<void(EntityId)> func) const
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::syncSignatures(std::vector<Signature>& signatures)
     {
-        forEach(func);
+        for (auto entity : m_structuralChanges)
+        {
+            if (entity >= signatures.size())
+            {
+                signatures.resize(static_cast<size_t>(entity) + 1);
+            }
+
+            signatures[entity].set(m_componentBit, m_index.check(entity));
+        }
+
+        m_structuralChanges.clear();
     }
 
-    template <typename Component>
-    inline void Table<Component>::forEach(std::function<void(EntityId, Component&)> func)
+    template <typename Component, bool IsTag, typename Index>
+    inline bool Table<Component, IsTag, Index>::synced() const
     {
-        // TODO: This should be a faster iteration than using the indexing operator's 
-        // hash map search, yet the query API uses that. This is also the only reason
-        // why we still duplicate ids to 'm_ids'. Should we pick one and go with it,
-        // or study new other (e.g. index offset calculation based) solutions?
+        return m_trackStructuralChanges && m_structuralChanges.empty();
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline CompactionStats Table<Component, IsTag, Index>::compact(const Timer& timer, double budgetMs)
+    {
+        return compactImpl(timer, budgetMs, std::is_same<Index, SparseIndex>());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline CompactionStats Table<Component, IsTag, Index>::compactImpl(
+        const Timer& timer,
+        double budgetMs,
+        std::true_type)
+    {
+        // Number of components processed between budget checks
+        static constexpr size_t k_stepsPerCheck = 256u;
+
+        CompactionStats stats;
+
+        if (m_archetypes)
+        {
+            return stats;
+        }
+
+        const size_t count = m_ids.size();
+        size_t slot = m_compactedCount;
+
+        // Continue from the first entity after the compacted range
+        auto it = slot > 0u ?
+            m_index.lowerBound(entityIndex(m_ids[slot - 1]) + 1) :
+            m_index.begin();
 
-        for (size_t i = 0; i < m_ids.size(); ++i)
+        for (; slot < count; ++slot, ++it)
         {
-            func(m_ids[i], m_components[i]);
+            if ((slot - m_compactedCount) % k_stepsPerCheck == 0u && 
+                timer.elapsed() >= budgetMs)
+            {
+                break;
+            }
+
+            // The n:th entity of the index belongs to the n:th slot
+            uint32_t source = m_idToComponentIndex.get(*it);
+            if (source != slot)
+            {
+                swapComponents(static_cast<uint32_t>(slot), source);
+                stats.moved++;
+            }
         }
+
+        m_compactedCount = slot;
+        stats.remaining = count - slot;
+
+        return stats;
     }
 
-    template <typename Component>
-    inline void Table<Component>::forEach(std::function<void(EntityId, Component&)> func) const
+    template <typename Component, bool IsTag, typename Index>
+    inline CompactionStats Table<Component, IsTag, Index>::compactImpl(
+        const Timer&,
+        double,
+        std::false_type)
+    {
+        // A sparse set is packed, appended and swap-removed in lockstep with
+        // the components, so they are always in the order of index iteration
+        CompactionStats stats;
+        return stats;
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::swapComponents(uint32_t lhs, uint32_t rhs)
+    {
+        std::swap(m_ids[lhs], m_ids[rhs]);
+        std::swap(m_components[lhs], m_components[rhs]);
+
+        m_idToComponentIndex.set(entityIndex(m_ids[lhs]), lhs);
+        m_idToComponentIndex.set(entityIndex(m_ids[rhs]), rhs);
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::invalidateCompaction(uint32_t entity)
+    {
+        if (m_compactedCount == 0u ||
+            entityIndex(m_ids[m_compactedCount - 1]) < entity)
+        {
+            return;
+        }
+
+        // Compacted range is sorted, so keep the entities ordered before 'entity'
+        auto end = m_ids.begin() + m_compactedCount;
+        auto it = std::lower_bound(m_ids.begin(), end, entity,
+            [](EntityId id, uint32_t entity) { return entityIndex(id) < entity; });
+
+        m_compactedCount = static_cast<size_t>(it - m_ids.begin());
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::appendCompaction(uint32_t entity)
+    {
+        invalidateCompaction(entity);
+
+        // Appending after the highest entity of a fully compacted
+        // table keeps the components in entity order
+        if (m_compactedCount == m_ids.size() &&
+            (m_ids.empty() || entityIndex(m_ids.back()) < entity))
+        {
+            m_compactedCount++;
+        }
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::attach(
+        unsigned componentBit,
+        ArchetypeStorage* archetypes,
+        const std::vector<uint16_t>*,
+        const uint32_t* changeTick)
+    {
+        assert(empty() && "Cannot attach table with components");
+
+        m_componentBit = componentBit;
+        m_archetypes = archetypes;
+        m_changeTick = changeTick;
+        m_trackStructuralChanges = true;
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::markWritten(EntityId id)
+    {
+        if (m_changeTick)
+        {
+            // Assigned components always have a stamp, so this never grows the array
+            assert(entityIndex(id) < m_writeTicks.size() && "Entity doesn't have component");
+            m_writeTicks[entityIndex(id)] = *m_changeTick;
+        }
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline uint32_t Table<Component, IsTag, Index>::writeTick(EntityId id) const
+    {
+        const uint32_t entity = entityIndex(id);
+        return entity < m_writeTicks.size() ? m_writeTicks[entity] : 0u;
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline void Table<Component, IsTag, Index>::markAssigned(uint32_t entity)
+    {
+        if (m_changeTick)
+        {
+            if (entity >= m_writeTicks.size())
+            {
+                m_writeTicks.resize(static_cast<size_t>(entity) + 1u, 0u);
+            }
+            m_writeTicks[entity] = *m_changeTick;
+        }
+    }
+
+    template <typename Component, bool IsTag, typename Index>
+    inline uint32_t Table<Component, IsTag, Index>::componentIndex(EntityId id) const
+    {
+        return m_idToComponentIndex.get(entityIndex(id));
+    }
+
+    // Table of tag components. Tags carry no data, so the table is only a
+    // sparse index of the entities which have the tag, and all entities
+    // share a single tag instance. Tags are never stored in archetypes, and are
+    // always indexed by SparseIndex, since they are assigned and cleared in bulk.
+    template <typename Tag, typename Index>
+    class Table<Tag, true, Index> : public ITable, public trait::non_copyable
+    {
+    public:
+        using IndexType = SparseIndex;
+
+        Table() = default;
+        ~Table() override = default;
+        Table(Table&&) = default;
+        Table& operator=(Table&&) = default;
+
+        void assign(EntityId id, Tag&& tag);
+        // Assign the tag to all entities in an index.
+        void assign(const SparseIndex& index);
+        // Assign the tag to a batch of entities, a whole block at a time.
+        void assignBatch(EntityRange ids);
+        void remove(EntityId id) override;
+        void clear() override;
+        bool empty() const override;
+        bool check(EntityId id) const;
+        size_t size() const;
+
+        std::vector<EntityId> ids() const;
+        const SparseIndex& index() const;
+
+        Tag* operator[](EntityId id);
+        const Tag* operator[](EntityId id) const;
+
+        template <typename F>
+        void forEach(F&& func) const;
+
+        void syncSignatures(std::vector<Signature>& signatures) override;
+        bool synced() const;
+
+        // Incremented whenever an entity gains or loses the tag.
+        uint64_t structuralVersion() const { return m_structuralVersion; }
+
+        // Tags have no stored components, so there is nothing to compact.
+        CompactionStats compact(const Timer&, double) override { return CompactionStats(); }
+
+        unsigned componentBit() const { return m_componentBit; }
+        ArchetypeStorage* archetypes() const { return nullptr; }
+
+    private:
+        friend class Database;
+
+        void attach(
+            unsigned componentBit,
+            ArchetypeStorage* archetypes,
+            const std::vector<uint16_t>* generations,
+            const uint32_t* changeTick);
+
+        template <typename F>
+        void forEachImpl(F& func, std::true_type withTag) const;
+        template <typename F>
+        void forEachImpl(F& func, std::false_type withTag) const;
+
+        EntityId entity(uint32_t index) const;
+
+    private:
+        SparseIndex m_index;
+
+        unsigned m_componentBit = 0u;
+
+        // Indices of entities which had the tag assigned or removed since
+        // the last sync point. Only tracked for tables owned by a database.
+        SparseIndex m_structuralChanges;
+        bool m_trackStructuralChanges = false;
+
+        uint64_t m_structuralVersion = 0u;
+
+        // Slot generations of the owning database, used to resolve entity 
+        // indices into ids. Without a database, ids carry no generation.
+        const std::vector<uint16_t>* m_generations = nullptr;
+
+        static Tag s_tag;
+    };
+
+    template <typename Tag, typename Index>
+    Tag Table<Tag, true, Index>::s_tag;
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::assign(EntityId id, Tag&&)
+    {
+        const uint32_t entity = entityIndex(id);
+
+        if (!m_index.check(entity))
+        {
+            m_structuralVersion++;
+        }
+
+        if (m_trackStructuralChanges)
+        {
+            m_structuralChanges.insert(entity);
+        }
+
+        m_index.insert(entity);
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::assign(const SparseIndex& index)
+    {
+        // Conservatively assume the index adds new entities
+        if (index.any())
+        {
+            m_structuralVersion++;
+        }
+
+        if (m_trackStructuralChanges)
+        {
+            m_structuralChanges |= index;
+        }
+
+        m_index |= index;
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::assignBatch(EntityRange ids)
+    {
+        if (ids.size() > 0u)
+        {
+            m_structuralVersion++;
+        }
+
+        if (m_trackStructuralChanges)
+        {
+            m_structuralChanges.insertRange(entityIndex(ids.first()), ids.size());
+        }
+
+        m_index.insertRange(entityIndex(ids.first()), ids.size());
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::remove(EntityId id)
+    {
+        const uint32_t entity = entityIndex(id);
+
+        if (m_index.check(entity))
+        {
+            m_structuralVersion++;
+
+            if (m_trackStructuralChanges)
+            {
+                m_structuralChanges.insert(entity);
+            }
+        }
+
+        m_index.erase(entity);
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::clear()
+    {
+        if (m_index.any())
+        {
+            m_structuralVersion++;
+        }
+
+        if (m_trackStructuralChanges)
+        {
+            m_structuralChanges |= m_index;
+        }
+
+        m_index.clear();
+    }
+
+    template <typename Tag, typename Index>
+    inline bool Table<Tag, true, Index>::empty() const
+    {
+        return m_index.empty();
+    }
+
+    template <typename Tag, typename Index>
+    inline bool Table<Tag, true, Index>::check(EntityId id) const
+    {
+        return m_index.check(entityIndex(id));
+    }
+
+    template <typename Tag, typename Index>
+    inline size_t Table<Tag, true, Index>::size() const
+    {
+        return m_index.size();
+    }
+
+    template <typename Tag, typename Index>
+    inline std::vector<EntityId> Table<Tag, true, Index>::ids() const
+    {
+        std::vector<EntityId> ids;
+
+        for (auto index : m_index)
+        {
+            ids.emplace_back(entity(index));
+        }
+
+        return ids;
+    }
+
+    template <typename Tag, typename Index>
+    inline const SparseIndex& Table<Tag, true, Index>::index() const
+    {
+        return m_index;
+    }
+
+    template <typename Tag, typename Index>
+    inline Tag* Table<Tag, true, Index>::operator[](EntityId id)
+    {
+        return check(id) ? &s_tag : nullptr;
+    }
+
+    template <typename Tag, typename Index>
+    inline const Tag* Table<Tag, true, Index>::operator[](EntityId id) const
+    {
+        return check(id) ? &s_tag : nullptr;
+    }
+
+    template <typename Tag, typename Index>
+    template <typename F>
+    inline void Table<Tag, true, Index>::forEach(F&& func) const
+    {
+        forEachImpl(func, std::integral_constant<bool,
+            trait::is_callable<F, EntityId, Tag&>::value>());
+    }
+
+    template <typename Tag, typename Index>
+    template <typename F>
+    inline void Table<Tag, true, Index>::forEachImpl(F& func, std::true_type) const
+    {
+        for (auto index : m_index)
+        {
+            func(entity(index), s_tag);
+        }
+    }
+
+    template <typename Tag, typename Index>
+    template <typename F>
+    inline void Table<Tag, true, Index>::forEachImpl(F& func, std::false_type) const
+    {
+        for (auto index : m_index)
+        {
+            func(entity(index));
+        }
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::syncSignatures(std::vector<Signature>& signatures)
+    {
+        for (auto entity : m_structuralChanges)
+        {
+            if (entity >= signatures.size())
+            {
+                signatures.resize(static_cast<size_t>(entity) + 1);
+            }
+
+            signatures[entity].set(m_componentBit, m_index.check(entity));
+        }
+
+        m_structuralChanges.clear();
+    }
+
+    template <typename Tag, typename Index>
+    inline bool Table<Tag, true, Index>::synced() const
+    {
+        return m_trackStructuralChanges && m_structuralChanges.empty();
+    }
+
+    template <typename Tag, typename Index>
+    inline void Table<Tag, true, Index>::attach(
+        unsigned componentBit,
+        ArchetypeStorage*,
+        const std::vector<uint16_t>* generations,
+        const uint32_t*)
+    {
+        assert(empty() && "Cannot attach table with components");
+
+        m_componentBit = componentBit;
+        m_generations = generations;
+        m_trackStructuralChanges = true;
+    }
+
+    template <typename Tag, typename Index>
+    inline EntityId Table<Tag, true, Index>::entity(uint32_t index) const
     {
-        forEach(func);
+        return m_generations ? makeEntityId(index, (*m_generations)[index]) : index;
     }
 
     // TODO: Enforce that only one reference to a table can be held at any given time?
@@ -4,7 +4,7 @@
 
 namespace eng
 {
-    class Hovered : public IComponent
+    class Hovered : public ITag
     {
     };
 }
\ No newline at end of file
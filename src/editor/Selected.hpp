@@ -4,7 +4,7 @@
 
 namespace eng
 {
-    class Selected : public IComponent
+    class Selected : public ITag
     { 
     };
 }
\ No newline at end of file
@@ -1,10 +1,7 @@
 #include <Precompiled.hpp>
 #include <graphics/RenderSystem.hpp>
 
-#include <editor/Hovered.hpp>
-#include <editor/Selected.hpp>
 #include <scene/Scene.hpp>
-#include <scene/Transform.hpp>
 #include <ui/Window.hpp>
 
 using namespace eng;
@@ -33,8 +30,39 @@ RenderSystem::~RenderSystem()
 {
 }
 
-void RenderSystem::update(const Scene&)
+void RenderSystem::onRegistered(const Scene& scene)
 {
+    System::onRegistered(scene);
+
+    // Tables of other systems exist once all systems are constructed
+    m_changedBoundsQuery = query()
+        .changedSince<Mesh, Transform>(m_lastUpdateTick)
+        .hasComponent<Transform>()
+        .hasComponent<Mesh>(m_meshTable)
+        .without<Deleted>();
+
+    m_meshQuery = query()
+        .hasComponent<Transform>()
+        .hasComponent<Mesh>();
+
+    m_hoveredQuery = query()
+        .hasComponent<Transform>()
+        .hasComponent<Mesh>()
+        .hasComponent<Hovered>();
+
+    m_selectedQuery = query()
+        .hasComponent<Transform>()
+        .hasComponent<Mesh>()
+        .hasComponent<Selected>();
+}
+
+void RenderSystem::update(const Scene& scene)
+{
+    // Writes made since the previous update are stamped with later ticks,
+    // including those of systems updated after this one in the last frame
+    const uint32_t since = m_lastUpdateTick;
+    m_lastUpdateTick = scene.database().changeTick();
+
     query()
         .hasComponent<Added>()
         .hasComponent<Mesh>(m_meshTable)
@@ -69,15 +97,12 @@ void RenderSystem::update(const Scene&)
         glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned) * mesh.indices.size(), &mesh.indices[0], GL_STATIC_DRAW);
     });
         
-    query()
-        .hasComponent<Updated>()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>(m_meshTable)
-        .execute([&](
-            EntityId id,
-            const Updated&,
-            const Transform& transform,
-            Mesh& mesh)
+    // Skip meshes which are about to be deleted. Bounds are computed
+    // independently for each mesh, so the entities are split over threads.
+    auto updateBounds = [&](
+        EntityId id,
+        const Transform& transform,
+        Mesh& mesh)
     {
         // Compute axis-aligned bounding box for updated rotation and scale,
         // so that it fully contains the mesh in any orientation
@@ -156,7 +181,14 @@ void RenderSystem::update(const Scene&)
             mesh.obb.halfExtents = transform.scale * aabb.halfExtents();
             mesh.obb.rotation = glm::mat3_cast(transform.rotation);
         }
-    });
+
+        m_meshTable.markWritten(id);
+    };
+
+    // The bounds written here are marked with the current tick, so the
+    // next update doesn't see them as changed.
+    m_changedBoundsQuery->setChangedSince(since);
+    m_changedBoundsQuery->executeParallel(updateBounds);
 
     query()
         .hasComponent<Deleted>()
@@ -192,13 +224,10 @@ void RenderSystem::render()
     assert(camera != nullptr && "No camera in scene");
 
     // Draw meshes
-    query()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>()
-        .execute([&](
-            EntityId id, 
-            const Transform& transform,
-            const Mesh& mesh)
+    m_meshQuery->execute(m_meshQueryCache, [&](
+        EntityId id, 
+        const Transform& transform,
+        const Mesh& mesh)
     {
         glEnable(GL_STENCIL_TEST);
 
@@ -219,15 +248,11 @@ void RenderSystem::render()
     });
 
     // Draw hovered meshes outline
-    query()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>()
-        .hasComponent<Hovered>()
-        .execute([&](
-            EntityId id,
-            const Transform& transform,
-            const Mesh& mesh,
-            const Hovered&)
+    m_hoveredQuery->execute(m_hoveredQueryCache, [&](
+        EntityId id,
+        const Transform& transform,
+        const Mesh& mesh,
+        const Hovered&)
     {
         glEnable(GL_STENCIL_TEST);
         glDisable(GL_DEPTH_TEST);
@@ -257,15 +282,11 @@ void RenderSystem::render()
     });
 
     // Draw selected meshes outline
-    query()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>()
-        .hasComponent<Selected>()
-        .execute([&](
-            EntityId id,
-            const Transform& transform,
-            const Mesh& mesh,
-            const Selected&)
+    m_selectedQuery->execute(m_selectedQueryCache, [&](
+        EntityId id,
+        const Transform& transform,
+        const Mesh& mesh,
+        const Selected&)
     {
         glEnable(GL_STENCIL_TEST);
         glDisable(GL_DEPTH_TEST);
@@ -295,13 +316,10 @@ void RenderSystem::render()
     });
     
     // Draw AABBs
-    query()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>()
-        .execute([&](
-            EntityId id,
-            const Transform& transform,
-            const Mesh& mesh)
+    m_meshQuery->execute(m_meshQueryCache, [&](
+        EntityId id,
+        const Transform& transform,
+        const Mesh& mesh)
     {
         auto min = mesh.aabb.min();
         auto max = mesh.aabb.max();
@@ -386,13 +404,10 @@ void RenderSystem::render()
     });
 
     // Draw OBBs
-    query()
-        .hasComponent<Transform>()
-        .hasComponent<Mesh>()
-        .execute([&](
-            EntityId id,
-            const Transform& transform,
-            const Mesh& mesh)
+    m_meshQuery->execute(m_meshQueryCache, [&](
+        EntityId id,
+        const Transform& transform,
+        const Mesh& mesh)
     {
         vec3 pos = mesh.obb.position;
         vec3 ext = mesh.obb.halfExtents;
@@ -1,9 +1,12 @@
 #pragma once
 
 #include <core/ecs/System.hpp>
+#include <editor/Hovered.hpp>
+#include <editor/Selected.hpp>
 #include <graphics/Mesh.hpp>
 #include <graphics/Shader.hpp>
 #include <graphics/Texture.hpp>
+#include <scene/Transform.hpp>
 
 namespace eng
 {
@@ -16,6 +19,7 @@ namespace eng
         RenderSystem(Database& db);
         ~RenderSystem() override;
 
+        void onRegistered(const Scene& scene) override;
         void update(const Scene& scene) override;
 
         void beginFrame();
@@ -25,6 +29,35 @@ namespace eng
     private:
         TableRef<Mesh> m_meshTable;
 
+        // Queries executed each frame, built once when the system is registered.
+        // Bounds are recomputed for meshes whose mesh or transform has been
+        // written since the previous update.
+        PersistentQuery<
+            ChangedTable<ConstTableRef<Mesh>, ConstTableRef<Transform>>,
+            ConstTableRef<Transform>,
+            TableRef<Mesh>,
+            ExcludedTable<ConstTableRef<Deleted>>> m_changedBoundsQuery;
+        PersistentQuery<
+            ConstTableRef<Transform>,
+            ConstTableRef<Mesh>> m_meshQuery;
+        PersistentQuery<
+            ConstTableRef<Transform>,
+            ConstTableRef<Mesh>,
+            ConstTableRef<Hovered>> m_hoveredQuery;
+        PersistentQuery<
+            ConstTableRef<Transform>,
+            ConstTableRef<Mesh>,
+            ConstTableRef<Selected>> m_selectedQuery;
+
+        // Matching entities of the render queries, kept between frames
+        // and recomputed only when meshes or transforms are added or removed.
+        QueryCache m_meshQueryCache;
+        QueryCache m_hoveredQueryCache;
+        QueryCache m_selectedQueryCache;
+
+        // Database change tick of the previous update
+        uint32_t m_lastUpdateTick = 0u;
+
         std::vector<gfx::Shader> m_shaders;
         std::vector<gfx::Texture> m_textures;
     };
@@ -7,6 +7,12 @@
 
 using namespace eng;
 
+namespace
+{
+    // Time spent per frame on reordering table components into entity order.
+    constexpr double k_compactionBudgetMs = 0.5;
+}
+
 Scene::Scene(std::shared_ptr<Window> window) :
     m_window(std::move(window)),
     m_transformSystem(m_database),
@@ -88,9 +94,17 @@ void Scene::update()
     
     m_editorSystem.processInput(window().frameInput());
 
+    // Sync point: apply structural changes to entity signatures before system updates
+    m_database.sync();
+
+    // Writes of each system update are stamped with a tick of their own, so
+    // that systems see the writes of systems executed after them too
     m_transformSystem.update(*this);
+    m_database.advanceChangeTick();
     m_renderSystem.update(*this);
+    m_database.advanceChangeTick();
     m_cameraSystem.update(*this);
+    m_database.advanceChangeTick();
 
     // TODO: multithreading, within system update or between updates?
     // causality scheduling (const, non-const) for individual queries?
@@ -101,6 +115,7 @@ void Scene::update()
 
     m_database.purgeDeleted();
     m_database.clearTags();
+    m_database.compact(k_compactionBudgetMs);
 }
 
 EntityId Scene::createEntity()
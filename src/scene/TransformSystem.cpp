@@ -18,6 +18,28 @@ TransformSystem::~TransformSystem()
 {
 }
 
+void TransformSystem::onRegistered(const Scene& scene)
+{
+    System::onRegistered(scene);
+
+    m_cameraQuery = query()
+        .hasComponent<Updated>()
+        .hasComponent<CameraControl>()
+        .hasComponent<Transform>(m_transformTable);
+
+    m_selectedBoundsQuery = query()
+        .hasComponent<Selected>()
+        .hasComponent<Transform>();
+
+    m_gizmoQuery = query()
+        .hasComponent<TransformGizmo>()
+        .hasComponent<Transform>(m_transformTable);
+
+    m_selectedQuery = query()
+        .hasComponent<Selected>()
+        .hasComponent<Transform>(m_transformTable);
+}
+
 void TransformSystem::schedule(Scheduler& scheduler)
 {
     // TODO: Scheduler
@@ -56,29 +78,23 @@ void TransformSystem::update(const Scene&)
     // TODO: Consider extending CameraControl into a "TransformControl" component 
     // which allows input and program control to any entity with a transform.
     // With this it might be wise to expect that the front vector is precomputed.
-    query()
-        .hasComponent<Updated>()
-        .hasComponent<CameraControl>()
-        .hasComponent<Transform>(m_transformTable)
-        .execute([&](
-            EntityId, 
-            const Updated&,
-            const CameraControl& control,
-            Transform& transform)
+    m_cameraQuery->execute([&](
+        EntityId id, 
+        const Updated&,
+        const CameraControl& control,
+        Transform& transform)
     {
         transformCamera(control, transform);
+        m_transformTable.markWritten(id);
     });
 
     // Compute bounds for selected objects
     AABB selectedBounds; // TODO: Don't calculate every frame
 
-    query()
-        .hasComponent<Selected>()
-        .hasComponent<Transform>()
-        .execute([&](
-            EntityId,
-            const Selected&,
-            const Transform& transform)
+    m_selectedBoundsQuery->execute([&](
+        EntityId,
+        const Selected&,
+        const Transform& transform)
     {
         selectedBounds.expand(transform.position);
     });
@@ -93,39 +109,49 @@ void TransformSystem::update(const Scene&)
     assert(camera != nullptr && "No camera in scene");
 
     Transform transformGizmoDelta;
+    bool gizmoMoved = false;
     
     // Move gizmo
-    query()
-        .hasComponent<TransformGizmo>()
-        .hasComponent<Transform>(m_transformTable)
-        .execute([&](
-            EntityId,
-            const TransformGizmo& gizmo,
-            Transform& transform)
+    m_gizmoQuery->execute([&](
+        EntityId id,
+        const TransformGizmo& gizmo,
+        Transform& transform)
     {
-        transformGizmoDelta = transformGizmo(
+        const bool recentered = transform.position != selectedBounds.center();
+
+        const bool moved = transformGizmo(
             *camera, 
             selectedBounds,
             gizmo,
-            transform);
+            transform,
+            transformGizmoDelta);
+
+        gizmoMoved = gizmoMoved || moved;
+
+        if (recentered || moved)
+        {
+            m_transformTable.markWritten(id);
+        }
     });
 
-    // TODO: Check if delta valid
+    // Selected objects only change when the gizmo is moved
+    if (!gizmoMoved)
+    {
+        return;
+    }
 
     // Apply delta transform to selected objects
-    query()
-        .hasComponent<Selected>()
-        .hasComponent<Transform>(m_transformTable)
-        .execute([&](
-            EntityId id,
-            const Selected&,
-            Transform& transform)
+    m_selectedQuery->execute([&](
+        EntityId id,
+        const Selected&,
+        Transform& transform)
     {
         // Note the order of addition for rotation
         transform.position += transformGizmoDelta.position;
         transform.rotation = transformGizmoDelta.rotation * transform.rotation;
         transform.scale += transformGizmoDelta.scale;
 
+        m_transformTable.markWritten(id);
         markUpdated(id);
     });
 }
@@ -170,11 +196,12 @@ void TransformSystem::transformCamera(
     transform.rotation = glm::quatLookAt(cameraFront, Camera::WorldUp);
 }
 
-Transform TransformSystem::transformGizmo(
+bool TransformSystem::transformGizmo(
     const Camera& camera,
     const AABB& selectedBounds,
     const TransformGizmo& transformGizmo,
-    Transform& transform)
+    Transform& transform,
+    Transform& delta)
 {
     // Move gizmo to selection center
     transform.position = selectedBounds.center();
@@ -192,8 +219,7 @@ Transform TransformSystem::transformGizmo(
 
     if (!gizmoUsed)
     {
-        // TODO: Problem?
-        return { {}, {}, {} };
+        return false;
     }
 
     // Decompose manipulated values back into component
@@ -208,10 +234,9 @@ Transform TransformSystem::transformGizmo(
         perspective);
 
     // Compute delta transform
-    Transform delta;
     delta.position = transform.position - previousTransform.position;
     delta.rotation = transform.rotation * glm::inverse(previousTransform.rotation);
     delta.scale = transform.scale - previousTransform.scale;
 
-    return delta;
+    return true;
 }
\ No newline at end of file
@@ -22,6 +22,7 @@ namespace eng
         TransformSystem(Database& db);
         ~TransformSystem();
 
+        void onRegistered(const Scene& scene) override;
         void update(const Scene& scene) override;
 
         
@@ -31,11 +32,14 @@ namespace eng
             const CameraControl& cameraControl,
             Transform& transform);
 
-        Transform transformGizmo(
+        // Manipulate the gizmo and return true if it was moved, with the
+        // change to the gizmo's transform in 'delta'.
+        bool transformGizmo(
             const Camera& camera,
             const AABB& selectedBounds,
             const TransformGizmo& transformGizmo, 
-            Transform& transform);
+            Transform& transform,
+            Transform& delta);
 
         // QUERY:  'translateCamera'
         // READS:  (Updated), CameraControl, Transform
@@ -51,5 +55,20 @@ namespace eng
 
     private:
         TableRef<Transform> m_transformTable;
+
+        // Queries executed each frame, built once when the system is registered.
+        PersistentQuery<
+            ConstTableRef<Updated>,
+            ConstTableRef<CameraControl>,
+            TableRef<Transform>> m_cameraQuery;
+        PersistentQuery<
+            ConstTableRef<Selected>,
+            ConstTableRef<Transform>> m_selectedBoundsQuery;
+        PersistentQuery<
+            ConstTableRef<TransformGizmo>,
+            TableRef<Transform>> m_gizmoQuery;
+        PersistentQuery<
+            ConstTableRef<Selected>,
+            TableRef<Transform>> m_selectedQuery;
     };
 }
\ No newline at end of file
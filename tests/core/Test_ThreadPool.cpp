@@ -0,0 +1,61 @@
+#include <Precompiled.hpp>
+
+#include <core/ThreadPool.hpp>
+
+#include <atomic>
+
+using namespace eng;
+
+TEST(ThreadPool, ExecutesEachTaskOnce)
+{
+    ThreadPool pool(3u);
+    EXPECT_EQ(4u, pool.threadCount());
+
+    std::vector<std::atomic<int>> counts(1000u);
+    for (auto& count : counts)
+    {
+        count = 0;
+    }
+
+    // Repeated loops reuse the same workers
+    for (int loop = 0; loop < 50; ++loop)
+    {
+        pool.parallelFor(counts.size(), [&](size_t task)
+        {
+            counts[task]++;
+        });
+    }
+
+    for (auto& count : counts)
+    {
+        EXPECT_EQ(50, count.load());
+    }
+
+    pool.parallelFor(0u, [&](size_t) { FAIL(); });
+}
+
+TEST(ThreadPool, NestedLoopsExecuteSerially)
+{
+    ThreadPool pool(2u);
+
+    std::atomic<size_t> total{ 0u };
+
+    pool.parallelFor(8u, [&](size_t)
+    {
+        pool.parallelFor(10u, [&](size_t task)
+        {
+            total += task;
+        });
+    });
+
+    EXPECT_EQ(8u * 45u, total.load());
+
+    // Without workers everything runs on the calling thread
+    ThreadPool serial(0u);
+    const auto caller = std::this_thread::get_id();
+
+    serial.parallelFor(4u, [&](size_t)
+    {
+        EXPECT_EQ(caller, std::this_thread::get_id());
+    });
+}
@@ -30,4 +30,18 @@ namespace eng
         TextComponent() = default;
         TextComponent(std::string value) : value(value) {}
     };
+
+    struct TagComponent : public ITag
+    {
+    };
+
+    struct SparseSetComponent : public IComponent
+    {
+        using Index = SparseSet;
+
+        int value = 0;
+
+        SparseSetComponent() = default;
+        SparseSetComponent(int value) : value(value) {}
+    };
 }
\ No newline at end of file
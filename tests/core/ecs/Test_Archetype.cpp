@@ -0,0 +1,131 @@
+#include <Precompiled.hpp>
+
+#include <core/ecs/Archetype.hpp>
+#include <core/ecs/TestComponents.hpp>
+
+using namespace eng;
+
+namespace
+{
+    constexpr unsigned k_number = 0u;
+    constexpr unsigned k_text = 1u;
+
+    ArchetypeStorage createStorage()
+    {
+        ArchetypeStorage storage;
+        storage.registerColumn(k_number, ComponentInfo::of<NumberComponent>());
+        storage.registerColumn(k_text, ComponentInfo::of<TextComponent>());
+        return storage;
+    }
+
+    int number(const ArchetypeStorage& storage, EntityId id)
+    {
+        return static_cast<NumberComponent*>(storage.get(id, k_number))->value;
+    }
+
+    std::string text(const ArchetypeStorage& storage, EntityId id)
+    {
+        return static_cast<TextComponent*>(storage.get(id, k_text))->value;
+    }
+}
+
+TEST(Archetype, AssignMovesEntityBetweenArchetypes)
+{
+    auto storage = createStorage();
+
+    NumberComponent number1(1);
+    TextComponent text1("one");
+
+    storage.assign(1u, k_number, &number1);
+    EXPECT_EQ(1u, storage.archetypeCount());
+    EXPECT_TRUE(storage.check(1u, k_number));
+    EXPECT_FALSE(storage.check(1u, k_text));
+
+    storage.assign(1u, k_text, &text1);
+    EXPECT_EQ(2u, storage.archetypeCount());
+    EXPECT_TRUE(storage.check(1u, k_number));
+    EXPECT_TRUE(storage.check(1u, k_text));
+    EXPECT_EQ(1, number(storage, 1u));
+    EXPECT_EQ("one", text(storage, 1u));
+}
+
+TEST(Archetype, AssignOverwritesExistingComponent)
+{
+    auto storage = createStorage();
+
+    NumberComponent number1(1);
+    NumberComponent number2(2);
+
+    storage.assign(1u, k_number, &number1);
+    storage.assign(1u, k_number, &number2);
+
+    EXPECT_EQ(1u, storage.archetypeCount());
+    EXPECT_EQ(2, number(storage, 1u));
+}
+
+TEST(Archetype, RemoveKeepsOtherEntities)
+{
+    auto storage = createStorage();
+
+    for (EntityId id = 1u; id <= 3u; ++id)
+    {
+        NumberComponent n(static_cast<int>(id));
+        TextComponent t(std::to_string(id));
+        storage.assign(id, k_number, &n);
+        storage.assign(id, k_text, &t);
+    }
+
+    storage.remove(1u, k_text);
+    storage.destroy(2u);
+
+    EXPECT_TRUE(storage.check(1u, k_number));
+    EXPECT_FALSE(storage.check(1u, k_text));
+    EXPECT_EQ(1, number(storage, 1u));
+
+    EXPECT_FALSE(storage.check(2u, k_number));
+    EXPECT_TRUE(storage.get(2u, k_number) == nullptr);
+
+    EXPECT_EQ(3, number(storage, 3u));
+    EXPECT_EQ("3", text(storage, 3u));
+
+    storage.remove(1u, k_number);
+    EXPECT_FALSE(storage.check(1u, k_number));
+}
+
+TEST(Archetype, EntitiesAreSplitIntoChunks)
+{
+    auto storage = createStorage();
+
+    static constexpr EntityId count = 5000u;
+    for (EntityId id = 1u; id <= count; ++id)
+    {
+        NumberComponent n(static_cast<int>(id));
+        storage.assign(id, k_number, &n);
+    }
+
+    Signature mask;
+    mask.set(k_number);
+
+    size_t chunks = 0u;
+    size_t entities = 0u;
+    int64_t sum = 0;
+
+    storage.forEachChunk(mask, [&](const Archetype& archetype, size_t chunk)
+    {
+        EXPECT_LE(archetype.entityCount(chunk), archetype.chunkCapacity());
+
+        auto numbers = static_cast<NumberComponent*>(archetype.column(chunk, k_number));
+        for (uint32_t row = 0; row < archetype.entityCount(chunk); ++row)
+        {
+            EXPECT_EQ(static_cast<int>(archetype.ids(chunk)[row]), numbers[row].value);
+            sum += numbers[row].value;
+        }
+
+        chunks++;
+        entities += archetype.entityCount(chunk);
+    });
+
+    EXPECT_GT(chunks, 1u);
+    EXPECT_EQ(count, entities);
+    EXPECT_EQ(int64_t(count) * (count + 1) / 2, sum);
+}
@@ -0,0 +1,332 @@
+#include <Precompiled.hpp>
+
+#include <core/Time.hpp>
+#include <core/ecs/CompressedIndex.hpp>
+#include <core/ecs/SparseIndex.hpp>
+
+#include <random>
+#include <set>
+
+using namespace eng;
+using namespace testing;
+
+namespace
+{
+    std::vector<EntityId> toVector(const CompressedIndex& index)
+    {
+        return std::vector<EntityId>(index.begin(), index.end());
+    }
+
+    std::vector<EntityId> toVector(const std::set<EntityId>& set)
+    {
+        return std::vector<EntityId>(set.begin(), set.end());
+    }
+}
+
+TEST(CompressedIndex, Insertion)
+{
+    CompressedIndex index;
+    EXPECT_TRUE(index.empty());
+    EXPECT_EQ(0u, index.size());
+
+    index.insert(100);
+    index.insert(100);
+    index.insert(200);
+    index.insert(5000000);
+
+    EXPECT_FALSE(index.empty());
+    EXPECT_EQ(3u, index.size());
+    EXPECT_TRUE(index.check(100));
+    EXPECT_TRUE(index.check(200));
+    EXPECT_TRUE(index.check(5000000));
+    EXPECT_FALSE(index.check(101));
+    EXPECT_FALSE(index.check(4999999));
+}
+
+TEST(CompressedIndex, InsertRangeAcrossChunks)
+{
+    CompressedIndex index;
+    index.insertRange(65530, 10);
+    index.insertRange(200000, 0);
+
+    EXPECT_EQ(10u, index.size());
+    EXPECT_FALSE(index.check(65529));
+    EXPECT_TRUE(index.check(65530));
+    EXPECT_TRUE(index.check(65539));
+    EXPECT_FALSE(index.check(65540));
+
+    // Range over an existing chunk merges with its values
+    index.insert(65545);
+    index.insertRange(65535, 20);
+
+    EXPECT_EQ(25u, index.size());
+    EXPECT_TRUE(index.check(65554));
+    EXPECT_FALSE(index.check(65555));
+}
+
+TEST(CompressedIndex, Iteration)
+{
+    CompressedIndex index;
+    index.insert(70000);
+    index.insert(3);
+    index.insertRange(10, 3);
+    index.insert(1u << 23);
+
+    std::vector<EntityId> expected = { 3, 10, 11, 12, 70000, 1u << 23 };
+    EXPECT_EQ(expected, toVector(index));
+
+    CompressedIndex empty;
+    EXPECT_TRUE(empty.begin() == empty.end());
+}
+
+TEST(CompressedIndex, Removal)
+{
+    CompressedIndex index;
+    index.insertRange(100, 10);
+    index.insert(300000);
+
+    index.erase(105);
+    index.erase(300000);
+    index.erase(300001);
+    index.erase(999999);
+
+    EXPECT_EQ(9u, index.size());
+    EXPECT_FALSE(index.check(105));
+    EXPECT_FALSE(index.check(300000));
+    EXPECT_TRUE(index.check(104));
+    EXPECT_TRUE(index.check(106));
+
+    index.clear();
+    EXPECT_TRUE(index.empty());
+    EXPECT_TRUE(index.begin() == index.end());
+}
+
+TEST(CompressedIndex, ContainersConvertAroundArrayLimit)
+{
+    CompressedIndex index;
+
+    // Every other id of a chunk, too many for an array container
+    for (EntityId id = 0; id < 20000; id += 2)
+    {
+        index.insert(id);
+    }
+    EXPECT_EQ(10000u, index.size());
+
+    for (EntityId id = 0; id < 19000; id += 2)
+    {
+        index.erase(id);
+    }
+    EXPECT_EQ(500u, index.size());
+
+    std::vector<EntityId> expected;
+    for (EntityId id = 19000; id < 20000; id += 2)
+    {
+        expected.emplace_back(id);
+    }
+    EXPECT_EQ(expected, toVector(index));
+}
+
+TEST(CompressedIndex, OptimizeKeepsValues)
+{
+    CompressedIndex index;
+    index.insertRange(0, 200000);
+    for (EntityId id = 1000; id < 1100; ++id)
+    {
+        index.erase(id);
+    }
+    index.insert(500000);
+
+    const size_t before = index.memoryUsage();
+    const std::vector<EntityId> values = toVector(index);
+
+    index.optimize();
+
+    EXPECT_LT(index.memoryUsage(), before);
+    EXPECT_EQ(values, toVector(index));
+    EXPECT_FALSE(index.check(1050));
+    EXPECT_TRUE(index.check(1100));
+}
+
+TEST(CompressedIndex, BitwiseOperationsMatchReference)
+{
+    std::mt19937 random(7);
+    std::uniform_int_distribution<EntityId> sparseIds(0u, 1000000u);
+    std::uniform_int_distribution<EntityId> denseIds(0u, 70000u);
+
+    // Mix sparse, dense and run containers over a few chunks
+    auto makeIndex = [&](std::set<EntityId>& reference, unsigned sparse, unsigned dense, EntityId run)
+    {
+        CompressedIndex index;
+        for (unsigned i = 0; i < sparse; ++i)
+        {
+            EntityId id = sparseIds(random);
+            index.insert(id);
+            reference.insert(id);
+        }
+        for (unsigned i = 0; i < dense; ++i)
+        {
+            EntityId id = denseIds(random);
+            index.insert(id);
+            reference.insert(id);
+        }
+        for (EntityId id = run; id < run + 5000; ++id)
+        {
+            reference.insert(id);
+        }
+        index.insertRange(run, 5000);
+        return index;
+    };
+
+    for (int round = 0; round < 4; ++round)
+    {
+        std::set<EntityId> referenceA;
+        std::set<EntityId> referenceB;
+        CompressedIndex a = makeIndex(referenceA, 2000, round * 20000, 128000);
+        CompressedIndex b = makeIndex(referenceB, 3000, 30000 - round * 10000, 130000);
+        if (round % 2 == 1)
+        {
+            a.optimize();
+        }
+
+        std::set<EntityId> expectedOr;
+        std::set<EntityId> expectedAnd;
+        std::set<EntityId> expectedXor;
+        std::set_union(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+            std::inserter(expectedOr, expectedOr.end()));
+        std::set_intersection(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+            std::inserter(expectedAnd, expectedAnd.end()));
+        std::set_symmetric_difference(referenceA.begin(), referenceA.end(), referenceB.begin(), referenceB.end(),
+            std::inserter(expectedXor, expectedXor.end()));
+
+        CompressedIndex resultOr = a | b;
+        CompressedIndex resultAnd = a & b;
+        CompressedIndex resultXor = a ^ b;
+
+        EXPECT_EQ(toVector(expectedOr), toVector(resultOr));
+        EXPECT_EQ(expectedOr.size(), resultOr.size());
+        EXPECT_EQ(toVector(expectedAnd), toVector(resultAnd));
+        EXPECT_EQ(expectedAnd.size(), resultAnd.size());
+        EXPECT_EQ(toVector(expectedXor), toVector(resultXor));
+        EXPECT_EQ(expectedXor.size(), resultXor.size());
+
+        EXPECT_TRUE((a ^ a).empty());
+        EXPECT_EQ(toVector(referenceA), toVector(a & a));
+    }
+}
+
+TEST(CompressedIndex, PerformanceTestMemory)
+{
+    static constexpr uint32_t maxId = 1u << 24;
+
+    // Sparse tag spread over the whole id range
+    SparseIndex sparseTags;
+    CompressedIndex compressedTags;
+    for (uint32_t id = 12345u; id < maxId; id += 10007u)
+    {
+        sparseTags.insert(id);
+        compressedTags.insert(id);
+    }
+
+    // Dense table at the end of the id range
+    SparseIndex sparseTable;
+    CompressedIndex compressedTable;
+    sparseTable.insertRange(maxId - 1000000u, 1000000u);
+    compressedTable.insertRange(maxId - 1000000u, 1000000u);
+
+    const size_t tableBeforeOptimize = compressedTable.memoryUsage();
+    compressedTable.optimize();
+    compressedTags.optimize();
+
+    EXPECT_EQ(sparseTags.size(), compressedTags.size());
+    EXPECT_EQ(sparseTable.size(), compressedTable.size());
+    EXPECT_LT(compressedTags.memoryUsage(), sparseTags.memoryUsage());
+    EXPECT_LT(compressedTable.memoryUsage(), sparseTable.memoryUsage());
+
+    std::cout <<
+        "Tag ids:                     " << compressedTags.size() << std::endl <<
+        "Tag bytes (sparse):          " << sparseTags.memoryUsage() << std::endl <<
+        "Tag bytes (compressed):      " << compressedTags.memoryUsage() << std::endl <<
+        "Table ids:                   " << compressedTable.size() << std::endl <<
+        "Table bytes (sparse):        " << sparseTable.memoryUsage() << std::endl <<
+        "Table bytes (compressed):    " << tableBeforeOptimize << std::endl <<
+        "Table bytes (optimized):     " << compressedTable.memoryUsage() << std::endl;
+}
+
+TEST(CompressedIndex, PerformanceTestThroughput)
+{
+    static constexpr uint32_t maxId = 1u << 24;
+
+    std::mt19937 random(1);
+    std::uniform_int_distribution<uint32_t> ids(0u, maxId - 1);
+
+    // Dense table with a few holes, intersected with a sparse tag
+    std::vector<EntityId> holes(10000);
+    std::vector<EntityId> tagIds(1000);
+    std::generate(holes.begin(), holes.end(), [&] { return ids(random); });
+    std::generate(tagIds.begin(), tagIds.end(), [&] { return ids(random); });
+
+    auto measure = [&](auto index, const char* name)
+    {
+        using Index = decltype(index);
+
+        Timer timer = Timer::start();
+
+        Index table;
+        table.insertRange(0u, maxId);
+        for (auto id : holes)
+        {
+            table.erase(id);
+        }
+
+        Index tags;
+        for (auto id : tagIds)
+        {
+            tags.insert(id);
+        }
+
+        double elapsedBuild = timer.reset();
+
+        Index result = tags;
+        result &= table;
+        size_t tagMatches = 0;
+        for (auto it = result.begin(); it != result.end(); ++it)
+        {
+            ++tagMatches;
+        }
+
+        double elapsedAndTags = timer.reset();
+
+        Index combined = table;
+        combined &= table;
+
+        double elapsedAndTables = timer.reset();
+
+        size_t count = 0;
+        for (auto it = table.begin(); it != table.end(); ++it)
+        {
+            ++count;
+        }
+
+        double elapsedIterate = timer.reset();
+
+        EXPECT_EQ(table.size(), count);
+        EXPECT_EQ(count, combined.size());
+
+        std::cout <<
+            name << std::endl <<
+            "  Ids:                 " << count << std::endl <<
+            "  Tag matches:         " << tagMatches << std::endl <<
+            "  Bytes:               " << table.memoryUsage() << std::endl <<
+            "  Elapsed (build):     " << elapsedBuild << " ms" << std::endl <<
+            "  Elapsed (and tags):  " << elapsedAndTags << " ms" << std::endl <<
+            "  Elapsed (and table): " << elapsedAndTables << " ms" << std::endl <<
+            "  Elapsed (iterate):   " << elapsedIterate << " ms" << std::endl;
+
+        return tagMatches;
+    };
+
+    size_t sparseMatches = measure(SparseIndex(), "SparseIndex");
+    size_t compressedMatches = measure(CompressedIndex(), "CompressedIndex");
+
+    EXPECT_EQ(sparseMatches, compressedMatches);
+}
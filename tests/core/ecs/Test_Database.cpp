@@ -0,0 +1,306 @@
+#include <Precompiled.hpp>
+
+#include <core/Time.hpp>
+#include <core/ecs/Database.hpp>
+#include <core/ecs/Query.hpp>
+#include <core/ecs/TestComponents.hpp>
+
+using namespace eng;
+
+namespace
+{
+    void deleteEntity(Database& database, EntityId id)
+    {
+        database.table<Deleted>().assign(id, Deleted());
+        database.purgeDeleted();
+        database.clearTags();
+    }
+}
+
+TEST(Database, CreateEntityReturnsValidIds)
+{
+    Database database;
+
+    auto id1 = database.createEntity();
+    auto id2 = database.createEntity();
+
+    EXPECT_NE(InvalidId, id1);
+    EXPECT_NE(id1, id2);
+    EXPECT_TRUE(database.valid(id1));
+    EXPECT_TRUE(database.valid(id2));
+    EXPECT_FALSE(database.valid(InvalidId));
+}
+
+TEST(Database, PurgedEntityIdBecomesStale)
+{
+    Database database;
+
+    auto& table = database.createTable<NumberComponent>();
+
+    auto id = database.createEntity();
+    table.assign(id, NumberComponent(10));
+
+    deleteEntity(database, id);
+
+    EXPECT_FALSE(database.valid(id));
+    EXPECT_FALSE(table.check(id));
+
+    // Slot is recycled with a new generation
+    auto newId = database.createEntity();
+
+    EXPECT_EQ(entityIndex(id), entityIndex(newId));
+    EXPECT_NE(entityGeneration(id), entityGeneration(newId));
+    EXPECT_TRUE(database.valid(newId));
+    EXPECT_FALSE(database.valid(id));
+    EXPECT_FALSE(table.check(newId));
+
+    table.assign(newId, NumberComponent(20));
+
+    auto ids = query(database).hasComponent<NumberComponent>().ids();
+    ASSERT_EQ(1u, ids.size());
+    EXPECT_EQ(newId, ids[0]);
+    ASSERT_EQ(1u, table.ids().size());
+    EXPECT_EQ(newId, table.ids()[0]);
+}
+
+TEST(Database, SaturatedSlotIsRetired)
+{
+    Database database;
+
+    const EntityId first = database.createEntity();
+    deleteEntity(database, first);
+
+    EntityId id = InvalidId;
+    uint32_t reuses = 0u;
+
+    // Recycle the same slot until every generation has been used, and then some
+    for (uint32_t i = 0; i <= k_maxEntityGeneration + 1u; ++i)
+    {
+        id = database.createEntity();
+        reuses += entityIndex(id) == entityIndex(first) ? 1u : 0u;
+
+        EXPECT_FALSE(database.valid(first));
+        deleteEntity(database, id);
+    }
+
+    // Generations 1...max-1 were handed out once each after the first
+    EXPECT_EQ(k_maxEntityGeneration - 1u, reuses);
+
+    // A new entity never revalidates a handle to the retired slot
+    id = database.createEntity();
+    EXPECT_NE(entityIndex(first), entityIndex(id));
+    EXPECT_FALSE(database.valid(first));
+    EXPECT_FALSE(database.valid(makeEntityId(entityIndex(first), k_maxEntityGeneration)));
+    EXPECT_TRUE(database.valid(id));
+}
+
+TEST(Database, RecycledSlotsKeepIndicesCompact)
+{
+    for (auto backend : { StorageBackend::Tables, StorageBackend::Archetypes })
+    {
+        Database database(backend);
+
+        auto& table = database.createTable<NumberComponent>();
+
+        uint32_t maxIndex = 0u;
+
+        for (int i = 0; i < 10000; ++i)
+        {
+            auto id = database.createEntity();
+            table.assign(id, NumberComponent(i));
+
+            maxIndex = std::max(maxIndex, entityIndex(id));
+
+            deleteEntity(database, id);
+        }
+
+        EXPECT_LE(maxIndex, 1u);
+        EXPECT_TRUE(table.empty());
+    }
+}
+
+TEST(Database, ComponentTypeIdsAreUniquePerType)
+{
+    auto boolId = componentTypeId<BoolComponent>();
+    auto numberId = componentTypeId<NumberComponent>();
+
+    EXPECT_NE(boolId, numberId);
+    EXPECT_EQ(boolId, componentTypeId<BoolComponent>());
+    EXPECT_EQ(numberId, componentTypeId<NumberComponent>());
+}
+
+TEST(Database, TablesAreFoundByComponentType)
+{
+    Database database;
+
+    auto& table1 = database.createTable<BoolComponent>();
+    auto& table2 = database.createTable<NumberComponent>();
+
+    EXPECT_EQ(&table1, &database.table<BoolComponent>());
+    EXPECT_EQ(&table2, &database.table<NumberComponent>());
+    EXPECT_NE(table1.componentBit(), table2.componentBit());
+}
+
+TEST(Database, TagTablesResolveRecycledIds)
+{
+    Database database;
+
+    auto& tags = database.createTable<TagComponent>();
+
+    auto id = database.createEntity();
+    deleteEntity(database, id);
+
+    auto newId = database.createEntity();
+    tags.assign(newId, TagComponent());
+
+    EXPECT_EQ(std::vector<EntityId>{ newId }, tags.ids());
+    EXPECT_EQ(std::vector<EntityId>{ newId }, query(database).hasComponent<TagComponent>().ids());
+
+    database.sync();
+
+    EXPECT_TRUE(database.signature(newId).test(tags.componentBit()));
+
+    database.table<Updated>().assign(tags.index());
+    database.sync();
+
+    EXPECT_EQ(std::vector<EntityId>{ newId }, query(database)
+        .hasComponent<TagComponent>()
+        .hasComponent<Updated>()
+        .ids());
+
+    database.clearTags();
+    database.sync();
+
+    EXPECT_FALSE(database.signature(newId).test(database.table<Updated>().componentBit()));
+}
+
+TEST(Database, CreateEntitiesReturnsConsecutiveIds)
+{
+    Database database;
+
+    auto single = database.createEntity();
+    deleteEntity(database, single);
+
+    auto range = database.createEntities(3u);
+
+    ASSERT_EQ(3u, range.size());
+    EXPECT_EQ(range[0] + 1u, range[1]);
+    EXPECT_EQ(range[1] + 1u, range[2]);
+    EXPECT_NE(entityIndex(single), entityIndex(range[0]));
+
+    for (auto id : range)
+    {
+        EXPECT_TRUE(database.valid(id));
+    }
+
+    // Recycled slot is still available for single entities
+    EXPECT_EQ(entityIndex(single), entityIndex(database.createEntity()));
+}
+
+TEST(Database, CompactVisitsAllTables)
+{
+    Database database;
+
+    auto& numbers = database.createTable<NumberComponent>();
+    auto& texts = database.createTable<TextComponent>();
+
+    auto ids = database.createEntities(4u);
+    for (uint32_t i = 4u; i > 0u; --i)
+    {
+        numbers.assign(ids[i - 1], NumberComponent(static_cast<int>(i)));
+        texts.assign(ids[i - 1], TextComponent("text"));
+    }
+
+    auto stats = database.compact(1000.0);
+
+    EXPECT_EQ(4u, stats.moved);
+    EXPECT_EQ(0u, stats.remaining);
+    EXPECT_EQ(ids[0], numbers.ids()[0]);
+    EXPECT_EQ(ids[0], texts.ids()[0]);
+    EXPECT_EQ(1, numbers[ids[0]]->value);
+}
+
+TEST(Database, TablesStampAssignmentsWithChangeTick)
+{
+    Database database;
+    auto& table = database.createTable<NumberComponent>();
+
+    auto id1 = database.createEntity();
+    auto id2 = database.createEntity();
+
+    EXPECT_EQ(1u, database.changeTick());
+    EXPECT_EQ(0u, table.writeTick(id1));
+
+    table.assign(id1, NumberComponent(1));
+    EXPECT_EQ(1u, table.writeTick(id1));
+    EXPECT_EQ(0u, table.writeTick(id2));
+
+    database.advanceChangeTick();
+    EXPECT_EQ(2u, database.changeTick());
+
+    table.assign(id2, NumberComponent(2));
+    EXPECT_EQ(1u, table.writeTick(id1));
+    EXPECT_EQ(2u, table.writeTick(id2));
+
+    // Moved databases keep stamping with the same change tick
+    Database moved(std::move(database));
+    moved.advanceChangeTick();
+
+    auto& movedTable = moved.table<NumberComponent>();
+    movedTable.markWritten(id1);
+    EXPECT_EQ(3u, movedTable.writeTick(id1));
+}
+
+TEST(Database, PerformanceTestBatchCreation)
+{
+    static constexpr uint32_t count = 100000u;
+
+    double elapsedSingle = 0.0;
+    double elapsedBatch = 0.0;
+
+    {
+        Database database;
+        auto& table = database.createTable<NumberComponent>();
+        auto& added = database.table<Added>();
+
+        Timer timer = Timer::start();
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            auto id = database.createEntity();
+            table.assign(id, NumberComponent(static_cast<int>(i)));
+            added.assign(id, Added());
+        }
+
+        elapsedSingle = timer.reset();
+        EXPECT_EQ(count, table.size());
+    }
+
+    {
+        Database database;
+        auto& table = database.createTable<NumberComponent>();
+        auto& added = database.table<Added>();
+
+        std::vector<NumberComponent> components;
+        components.reserve(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            components.emplace_back(static_cast<int>(i));
+        }
+
+        Timer timer = Timer::start();
+
+        auto ids = database.createEntities(count);
+        table.assignBatch(ids, Span<NumberComponent>(components.data(), components.size()));
+        added.assignBatch(ids);
+
+        elapsedBatch = timer.reset();
+        EXPECT_EQ(count, table.size());
+        EXPECT_EQ(count, added.size());
+    }
+
+    std::cout <<
+        "Entities:         " << count << std::endl <<
+        "Elapsed (single): " << elapsedSingle << " ms" << std::endl <<
+        "Elapsed (batch):  " << elapsedBatch << " ms" << std::endl;
+}
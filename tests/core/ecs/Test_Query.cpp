@@ -1,9 +1,13 @@
 #include <Precompiled.hpp>
 
 #include <core/ecs/Database.hpp>
+#include <core/ecs/PersistentQuery.hpp>
 #include <core/ecs/Query.hpp>
 #include <core/ecs/TestComponents.hpp>
 
+#include <atomic>
+#include <numeric>
+
 using namespace eng;
 
 TEST(Query, IsExecutedOnceWhenComponentMatches)
@@ -257,61 +261,1296 @@ TEST(Query, FindComponentOfFirstMatchingEntity)
     ASSERT_TRUE(result3 == nullptr);
 }
 
-TEST(Query, PerformanceTest)
+TEST(Query, IteratesMatchesInRangeBasedFor)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<SparseSetComponent>();
+    auto& table3 = database.createTable<TagComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 200; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), NumberComponent(i));
+    }
+    for (int i = 0; i < 200; i += 3)
+    {
+        table2.assign(ids[i], SparseSetComponent(i));
+    }
+    table3.assign(ids[3], TagComponent());
+
+    for (bool synced : { false, true })
+    {
+        if (synced)
+        {
+            database.sync();
+        }
+
+        // Walks the ids of the smaller sparse set, in its insertion order
+        std::vector<EntityId> result;
+        for (EntityId id : query(database)
+            .hasComponent<NumberComponent>()
+            .hasComponent<SparseSetComponent>()
+            .without<TagComponent>())
+        {
+            result.emplace_back(id);
+        }
+
+        auto q = query(database)
+            .hasComponent<NumberComponent>()
+            .hasComponent<SparseSetComponent>()
+            .without<TagComponent>();
+
+        EXPECT_EQ(q.ids(), result);
+        EXPECT_EQ(66u, result.size());
+        EXPECT_EQ(ids[0], result[0]);
+        EXPECT_EQ(ids[6], result[1]);
+
+        // Iteration stops without visiting the remaining matches
+        size_t visited = 0;
+        for (EntityId id : query(database).hasComponent<NumberComponent>())
+        {
+            ++visited;
+            if (id == ids[9])
+            {
+                break;
+            }
+        }
+        EXPECT_EQ(10u, visited);
+
+        auto empty = query(database)
+            .hasComponent<TagComponent>()
+            .without<SparseSetComponent>();
+        EXPECT_TRUE(empty.begin() == empty.end());
+    }
+}
+
+#ifndef NDEBUG
+TEST(Query, AssertsOnStructuralChangeDuringExecution)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<SparseSetComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 4; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), NumberComponent(i));
+        table2.assign(ids.back(), SparseSetComponent(i));
+    }
+
+    // Removal would swap the last id of the sparse set under the walk
+    EXPECT_DEATH(query(database)
+        .hasComponent<NumberComponent>()
+        .hasComponent<SparseSetComponent>()
+        .executeIds([&](EntityId id)
+    {
+        table2.remove(id);
+    }), "Cannot add or remove components while executing query");
+
+    // Changes deferred until after the query are fine
+    std::vector<EntityId> removed;
+    query(database)
+        .hasComponent<NumberComponent>()
+        .hasComponent<SparseSetComponent>()
+        .executeIds([&](EntityId id)
+    {
+        removed.emplace_back(id);
+    });
+
+    for (EntityId id : removed)
+    {
+        table2.remove(id);
+    }
+
+    EXPECT_EQ(4u, removed.size());
+    EXPECT_TRUE(table2.empty());
+}
+#endif
+
+TEST(Query, PersistentQueryIsBuiltOnce)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<BoolComponent>();
+    auto& table3 = database.createTable<TagComponent>();
+
+    PersistentQuery<
+        TableRef<NumberComponent>,
+        ConstTableRef<BoolComponent>,
+        ExcludedTable<ConstTableRef<TagComponent>>> persistent;
+
+    EXPECT_FALSE(persistent.built());
+
+    persistent = query(database)
+        .hasComponent<NumberComponent>(table1)
+        .hasComponent<BoolComponent>()
+        .without<TagComponent>();
+
+    ASSERT_TRUE(persistent.built());
+    EXPECT_TRUE(persistent->signature().test(table1.componentBit()));
+    EXPECT_TRUE(persistent->excludedSignature().test(table3.componentBit()));
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 5; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), NumberComponent(i));
+        table2.assign(ids.back(), BoolComponent(i % 2 == 0));
+    }
+    table3.assign(ids[4], TagComponent());
+
+    // Executions see the entities of each frame
+    for (int frame = 0; frame < 3; ++frame)
+    {
+        persistent->execute([&](EntityId, NumberComponent& number, const BoolComponent& flag)
+        {
+            number.value += flag.value ? 10 : 0;
+        });
+
+        database.sync();
+    }
+
+    EXPECT_EQ(30, table1[ids[0]]->value);
+    EXPECT_EQ(1, table1[ids[1]]->value);
+    EXPECT_EQ(32, table1[ids[2]]->value);
+    EXPECT_EQ(4, table1[ids[4]]->value);
+
+    table3.remove(ids[4]);
+
+    EXPECT_EQ((std::vector<EntityId>{ ids[0], ids[1], ids[2], ids[3], ids[4] }), (*persistent).ids());
+}
+
+TEST(Query, MatchesSignaturesAfterSync)
 {
     Database database;
 
     auto& table1 = database.createTable<BoolComponent>();
     auto& table2 = database.createTable<NumberComponent>();
-    auto& table3 = database.createTable<TextComponent>();
 
-    size_t count = 2000u;
+    std::vector<EntityId> ids;
+    ids.emplace_back(database.createEntity());
+    ids.emplace_back(database.createEntity());
+    ids.emplace_back(database.createEntity());
+
+    table1.assign(ids[0], BoolComponent(true));
+    table2.assign(ids[0], NumberComponent(0));
+    table1.assign(ids[1], BoolComponent(true));
+    table2.assign(ids[2], NumberComponent(0));
+
+    EXPECT_FALSE(table1.synced());
+    EXPECT_TRUE(database.signature(ids[0]).none());
+
+    database.sync();
+
+    EXPECT_TRUE(table1.synced());
+    EXPECT_TRUE(table2.synced());
+    EXPECT_EQ(2u, database.signature(ids[0]).count());
+    EXPECT_TRUE(database.signature(ids[1]).test(table1.componentBit()));
+    EXPECT_TRUE(database.signature(ids[2]).test(table2.componentBit()));
+
+    auto q = query(database)
+        .hasComponent<BoolComponent>()
+        .hasComponent<NumberComponent>();
+
+    EXPECT_EQ(std::vector<EntityId>{ ids[0] }, q.ids());
+
+    // Unsynced structural changes fall back to matching against table indices
+    table2.remove(ids[0]);
+    table2.assign(ids[1], NumberComponent(1));
+
+    EXPECT_FALSE(table2.synced());
+    EXPECT_EQ(std::vector<EntityId>{ ids[1] }, q.ids());
+
+    database.sync();
+
+    EXPECT_FALSE(database.signature(ids[0]).test(table2.componentBit()));
+    EXPECT_EQ(std::vector<EntityId>{ ids[1] }, q.ids());
+    EXPECT_EQ(1u, q.index().size());
+}
+
+TEST(Query, PlansStrategyFromTableCardinality)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<BoolComponent>();
+    auto& table3 = database.createTable<TagComponent>();
+    auto& table4 = database.createTable<SparseSetComponent>();
 
     std::vector<EntityId> ids;
-    for (size_t i = 0; i < count; ++i)
-    { 
-        ids.emplace_back(database.createEntity());
-        table1.assign(ids.back(), BoolComponent(true));
-        
+    for (int i = 0; i < 10000; ++i)
+    {
         ids.emplace_back(database.createEntity());
-        table1.assign(ids.back(), BoolComponent(false));
-        table2.assign(ids.back(), NumberComponent(10));
+        table1.assign(ids.back(), NumberComponent(i));
+        table2.assign(ids.back(), BoolComponent(i % 2 == 0));
+    }
+    table3.assign(ids[5000], TagComponent());
+    table3.assign(ids[9000], TagComponent());
+    table4.assign(ids[7000], SparseSetComponent(7000));
+
+    for (bool synced : { false, true })
+    {
+        if (synced)
+        {
+            database.sync();
+        }
+
+        // Tables of similar size are intersected
+        auto dense = query(database)
+            .hasComponent<NumberComponent>()
+            .hasComponent<BoolComponent>();
+
+        QueryPlan plan = dense.plan();
+        EXPECT_EQ(QueryStrategy::IntersectBitsets, plan.strategy);
+        EXPECT_EQ(synced, plan.synced);
+        EXPECT_EQ(10000u, dense.ids().size());
+
+        // A tiny table is walked and the others probed for its entities only
+        auto selected = query(database)
+            .hasComponent<NumberComponent>()
+            .hasComponent<TagComponent>();
+
+        plan = selected.plan();
+        EXPECT_EQ(QueryStrategy::ProbeSmallest, plan.strategy);
+        EXPECT_EQ(1u, plan.smallest);
+        EXPECT_EQ(2u, plan.smallestSize);
+        EXPECT_LT(plan.probeCost, plan.intersectCost);
+        EXPECT_EQ((std::vector<EntityId>{ ids[5000], ids[9000] }), selected.ids());
+        EXPECT_EQ(2u, selected.index().size());
+
+        // Sparse sets can only be probed
+        auto sparse = query(database)
+            .hasComponent<NumberComponent>()
+            .hasComponent<SparseSetComponent>();
+
+        EXPECT_EQ(QueryStrategy::ProbeSmallest, sparse.plan().strategy);
+        EXPECT_EQ(std::vector<EntityId>{ ids[7000] }, sparse.ids());
+
+#ifndef NDEBUG
+        const QueryStats& stats = selected.stats();
+        EXPECT_EQ(2u, stats.probes);
+        EXPECT_EQ(0u, stats.intersections);
+        EXPECT_EQ(4u, stats.candidates);
+        EXPECT_EQ(4u, stats.matches);
+        EXPECT_DOUBLE_EQ(1.0, stats.selectivity());
+
+        EXPECT_EQ(1u, dense.stats().intersections);
+#endif
+    }
+}
+
+TEST(Query, MixesBitsetAndSparseSetTables)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<SparseSetComponent>();
 
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 10; ++i)
+    {
         ids.emplace_back(database.createEntity());
-        table1.assign(ids.back(), BoolComponent(true));
-        table3.assign(ids.back(), TextComponent("text"));
+        table1.assign(ids.back(), NumberComponent(i));
+    }
+
+    table2.assign(ids[7], SparseSetComponent(7));
+    table2.assign(ids[2], SparseSetComponent(2));
+    table2.assign(ids[5], SparseSetComponent(5));
+    table1.remove(ids[5]);
+
+    auto q = query(database)
+        .hasComponent<NumberComponent>()
+        .hasComponent<SparseSetComponent>();
+
+    // Unsynced tables are matched by probing the smaller sparse set
+    EXPECT_FALSE(table2.synced());
+    EXPECT_EQ((std::vector<EntityId>{ ids[7], ids[2] }), q.ids());
+    EXPECT_EQ(2u, q.index().size());
+
+    database.sync();
+
+    EXPECT_EQ((std::vector<EntityId>{ ids[7], ids[2] }), q.ids());
+
+    int sum = 0;
+    q.execute([&](EntityId, const NumberComponent& number, const SparseSetComponent& sparse)
+    {
+        EXPECT_EQ(number.value, sparse.value);
+        sum += sparse.value;
+    });
+    EXPECT_EQ(9, sum);
+}
+
+TEST(Query, ExcludesEntitiesWithComponent)
+{
+    Database database;
 
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<TagComponent>();
+    auto& table3 = database.createTable<SparseSetComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 6; ++i)
+    {
         ids.emplace_back(database.createEntity());
-        table2.assign(ids.back(), NumberComponent(100));
-        table3.assign(ids.back(), TextComponent("text"));
+        table1.assign(ids.back(), NumberComponent(i));
+    }
+
+    table2.assign(ids[1], TagComponent());
+    table2.assign(ids[4], TagComponent());
+    table3.assign(ids[2], SparseSetComponent(2));
+
+    auto run = [&]
+    {
+        std::vector<int> values;
+        query(database)
+            .hasComponent<NumberComponent>()
+            .without<TagComponent>()
+            .execute([&](EntityId, const NumberComponent& number)
+        {
+            values.emplace_back(number.value);
+        });
+        return values;
+    };
+
+    auto idsWithout = [&]
+    {
+        return query(database)
+            .hasComponent<NumberComponent>()
+            .without<TagComponent>()
+            .without<SparseSetComponent>()
+            .ids();
+    };
+
+    // Unsynced tables mask excluded indices out of the intersection
+    EXPECT_EQ((std::vector<int>{ 0, 2, 3, 5 }), run());
+    EXPECT_EQ((std::vector<EntityId>{ ids[0], ids[3], ids[5] }), idsWithout());
+    EXPECT_EQ(4u, query(database)
+        .hasComponent<NumberComponent>()
+        .without<TagComponent>()
+        .index().size());
+
+    database.sync();
+
+    // Synced tables are excluded by signature
+    EXPECT_EQ((std::vector<int>{ 0, 2, 3, 5 }), run());
+    EXPECT_EQ((std::vector<EntityId>{ ids[0], ids[3], ids[5] }), idsWithout());
+
+    table2.remove(ids[4]);
+    table2.assign(ids[0], TagComponent());
 
+    EXPECT_EQ((std::vector<int>{ 2, 3, 4, 5 }), run());
+}
+
+TEST(Query, PassesOptionalComponentsByPointer)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<TextComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 3; ++i)
+    {
         ids.emplace_back(database.createEntity());
-        table1.assign(ids.back(), BoolComponent(false));
-        table2.assign(ids.back(), NumberComponent(1000));
-        table3.assign(ids.back(), TextComponent("text"));
+        table1.assign(ids.back(), NumberComponent(i));
     }
-    
-    size_t found = 0u;
-    Timer timer = Timer::start();
+
+    table2.assign(ids[1], TextComponent("one"));
+
+    std::vector<std::string> texts;
 
     query(database)
-        .hasComponent<BoolComponent>()
         .hasComponent<NumberComponent>()
-        .hasComponent<TextComponent>()
-        .execute([&](
-            EntityId id,
-            const BoolComponent& c1,
-            const NumberComponent& c2,
-            const TextComponent& c3) 
+        .maybe<TextComponent>()
+        .execute([&](EntityId, const NumberComponent& number, const TextComponent* text)
     {
-        found++;
+        texts.emplace_back(text ? text->value : std::to_string(number.value));
     });
 
-    double elapsed = timer.reset();
-    EXPECT_EQ(found, count);
+    EXPECT_EQ((std::vector<std::string>{ "0", "one", "2" }), texts);
 
-    std::cout <<
-        "Entities: " << ids.size() << std::endl <<
-        "Matches:  " << found << std::endl <<
-        "Elapsed:  " << elapsed << " ms" << std::endl;
-}
\ No newline at end of file
+    // Mutable optional components can be written through the pointer
+    query(database)
+        .maybe(table2)
+        .hasComponent<NumberComponent>()
+        .execute([&](EntityId id, TextComponent* text, const NumberComponent&)
+    {
+        if (text)
+        {
+            text->value = "written";
+        }
+    });
+
+    EXPECT_EQ("written", table2[ids[1]]->value);
+    EXPECT_EQ(3u, query(database).hasComponent<NumberComponent>().maybe<TextComponent>().ids().size());
+}
+
+TEST(Query, CacheIsRebuiltOnlyOnStructuralChange)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<BoolComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 4; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), NumberComponent(i));
+    }
+    table2.assign(ids[1], BoolComponent(true));
+    table2.assign(ids[3], BoolComponent(false));
+
+    QueryCache cache;
+
+    auto run = [&]
+    {
+        int sum = 0;
+        query(database)
+            .hasComponent<NumberComponent>(table1)
+            .hasComponent<BoolComponent>()
+            .execute(cache, [&](EntityId, NumberComponent& number, const BoolComponent&)
+        {
+            sum += number.value;
+        });
+        return sum;
+    };
+
+    EXPECT_EQ(4, run());
+    EXPECT_EQ(4, run());
+    EXPECT_EQ(1u, cache.rebuildCount());
+    EXPECT_EQ((std::vector<EntityId>{ ids[1], ids[3] }), cache.ids());
+
+    // Writing component data keeps the cached ids
+    table1.assign(ids[3], NumberComponent(10));
+    database.sync();
+    EXPECT_EQ(11, run());
+    EXPECT_EQ(1u, cache.rebuildCount());
+
+    table2.remove(ids[1]);
+    EXPECT_EQ(10, run());
+    EXPECT_EQ(2u, cache.rebuildCount());
+
+    table2.assign(ids[0], BoolComponent(true));
+    EXPECT_EQ((std::vector<EntityId>{ ids[0], ids[3] }), query(database)
+        .hasComponent<NumberComponent>()
+        .hasComponent<BoolComponent>()
+        .ids(cache));
+    EXPECT_EQ(3u, cache.rebuildCount());
+
+    cache.invalidate();
+    EXPECT_EQ(10, run());
+    EXPECT_EQ(4u, cache.rebuildCount());
+
+    // Excluding a table of a shared cache's query is a different filter
+    EXPECT_EQ((std::vector<EntityId>{ ids[1], ids[2] }), query(database)
+        .hasComponent<NumberComponent>()
+        .without<BoolComponent>()
+        .ids(cache));
+    EXPECT_EQ(5u, cache.rebuildCount());
+
+    EXPECT_EQ(10, run());
+    EXPECT_EQ(6u, cache.rebuildCount());
+}
+
+TEST(Query, ExecutesInParallel)
+{
+    for (auto backend : { StorageBackend::Tables, StorageBackend::Archetypes })
+    {
+        Database database(backend);
+
+        auto& table1 = database.createTable<NumberComponent>();
+        auto& table2 = database.createTable<BoolComponent>();
+
+        static constexpr int count = 10000;
+
+        std::vector<EntityId> ids;
+        for (int i = 0; i < count; ++i)
+        {
+            ids.emplace_back(database.createEntity());
+            table1.assign(ids.back(), NumberComponent(i));
+
+            if (i % 3 != 0)
+            {
+                table2.assign(ids.back(), BoolComponent(i % 2 == 0));
+            }
+        }
+
+        ThreadPool pool(3u);
+
+        std::atomic<int> executed{ 0 };
+
+        query(database)
+            .hasComponent<BoolComponent>()
+            .hasComponent<NumberComponent>(table1)
+            .executeParallel([&](EntityId, const BoolComponent& flag, NumberComponent& number)
+        {
+            number.value = flag.value ? -number.value : number.value;
+            executed++;
+        }, pool);
+
+        int expected = 0;
+        for (int i = 0; i < count; ++i)
+        {
+            const bool negated = i % 3 != 0 && i % 2 == 0;
+            EXPECT_EQ(negated ? -i : i, table1[ids[i]]->value);
+            expected += i % 3 != 0 ? 1 : 0;
+        }
+        EXPECT_EQ(expected, executed.load());
+    }
+}
+
+TEST(Query, ExecutesChunksOfContiguousComponents)
+{
+    for (auto backend : { StorageBackend::Tables, StorageBackend::Archetypes })
+    {
+        Database database(backend);
+
+        auto& table1 = database.createTable<NumberComponent>();
+        auto& table2 = database.createTable<BoolComponent>();
+        auto& table3 = database.createTable<TextComponent>();
+        auto& table4 = database.createTable<TagComponent>();
+
+        static constexpr int count = 200;
+
+        std::vector<EntityId> ids;
+        for (int i = 0; i < count; ++i)
+        {
+            ids.emplace_back(database.createEntity());
+            table1.assign(ids.back(), NumberComponent(i));
+            table2.assign(ids.back(), BoolComponent(i % 5 == 0));
+            table4.assign(ids.back(), TagComponent());
+        }
+        for (int i = 0; i < count; i += 10)
+        {
+            table3.assign(ids[i], TextComponent("excluded"));
+        }
+
+        int matches = 0;
+        size_t chunks = 0;
+
+        query(database)
+            .hasComponent<NumberComponent>(table1)
+            .hasComponent<BoolComponent>()
+            .hasComponent<TagComponent>()
+            .without<TextComponent>()
+            .executeChunks([&](const QueryChunk& chunk, Span<NumberComponent> numbers, Span<const BoolComponent> flags)
+        {
+            ASSERT_EQ(chunk.size(), numbers.size());
+            ASSERT_EQ(chunk.size(), flags.size());
+            ASSERT_LE(chunk.size(), QueryChunk::k_maxSize);
+
+            for (size_t i = 0; i < chunk.size(); ++i)
+            {
+                EXPECT_EQ(numbers[i].value, table1[chunk.ids[i]]->value);
+
+                if (chunk.mask & (uint64_t(1) << i))
+                {
+                    numbers[i].value += flags[i].value ? 1000 : 0;
+                    matches++;
+                }
+            }
+            chunks++;
+        });
+
+        EXPECT_EQ(count - count / 10, matches);
+
+        for (int i = 0; i < count; ++i)
+        {
+            const bool updated = i % 5 == 0 && i % 10 != 0;
+            EXPECT_EQ(updated ? i + 1000 : i, table1[ids[i]]->value);
+        }
+
+        if (backend == StorageBackend::Tables)
+        {
+            // Excluded entities are masked out of runs over the whole block
+            EXPECT_EQ(4u, chunks);
+        }
+    }
+}
+
+TEST(Query, ExecutesChunksOfScatteredComponents)
+{
+    Database database;
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<TextComponent>();
+    auto& table3 = database.createTable<TagComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 100; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+    }
+
+    // Assign in reverse, so the components are not in entity order
+    for (int i = 99; i >= 0; --i)
+    {
+        table1.assign(ids[i], NumberComponent(i));
+        table3.assign(ids[i], TagComponent());
+    }
+    table2.assign(ids[20], TextComponent("20"));
+
+    std::vector<int> values;
+    std::vector<std::string> texts;
+
+    query(database)
+        .hasComponent<TagComponent>()
+        .hasComponent<NumberComponent>()
+        .maybe<TextComponent>()
+        .executeChunks([&](const QueryChunk& chunk, Span<const NumberComponent> numbers, Span<const TextComponent> text)
+    {
+        EXPECT_TRUE(chunk.dense());
+        EXPECT_TRUE(text.empty() || text.size() == chunk.size());
+
+        for (size_t i = 0; i < chunk.size(); ++i)
+        {
+            values.emplace_back(numbers[i].value);
+            if (!text.empty())
+            {
+                texts.emplace_back(text[i].value);
+            }
+        }
+    });
+
+    std::vector<int> expected(100);
+    std::iota(expected.begin(), expected.end(), 0);
+    EXPECT_EQ(expected, values);
+    EXPECT_EQ(std::vector<std::string>{ "20" }, texts);
+
+    // Compaction restores runs over whole blocks
+    Timer timer = Timer::start();
+    table1.compact(timer, 1000.0);
+
+    size_t chunks = 0;
+
+    query(database)
+        .hasComponent<NumberComponent>()
+        .executeChunks([&](const QueryChunk&, Span<const NumberComponent>)
+    {
+        chunks++;
+    });
+
+    EXPECT_EQ(2u, chunks);
+}
+
+TEST(Query, ArchetypeBackendMatchesTableBackend)
+{
+    Database database(StorageBackend::Archetypes);
+
+    auto& table1 = database.createTable<BoolComponent>();
+    auto& table2 = database.createTable<NumberComponent>();
+    auto& table3 = database.createTable<TextComponent>();
+
+    std::vector<EntityId> ids;
+    ids.emplace_back(database.createEntity());
+    ids.emplace_back(database.createEntity());
+    ids.emplace_back(database.createEntity());
+
+    table1.assign(ids[0], BoolComponent(true));
+    table2.assign(ids[0], NumberComponent(10));
+    table3.assign(ids[0], TextComponent("id0"));
+    table2.assign(ids[1], NumberComponent(20));
+    table1.assign(ids[1], BoolComponent(false));
+    table1.assign(ids[2], BoolComponent(true));
+    table3.assign(ids[2], TextComponent("id2"));
+
+    using ResultType = std::tuple<EntityId, bool, int>;
+    std::vector<ResultType> results;
+
+    query(database)
+        .hasComponent<BoolComponent>()
+        .hasComponent<NumberComponent>(table2)
+        .execute([&](
+            EntityId id,
+            const BoolComponent& c1,
+            NumberComponent& c2)
+    {
+        c2.value++;
+        results.emplace_back(std::make_tuple(id, c1.value, c2.value));
+    });
+
+    EXPECT_THAT(results, testing::UnorderedElementsAre(
+        std::make_tuple(ids[0], true, 11),
+        std::make_tuple(ids[1], false, 21)));
+
+    table1.remove(ids[0]);
+
+    EXPECT_EQ(1u, query(database)
+        .hasComponent<BoolComponent>()
+        .hasComponent<NumberComponent>()
+        .ids().size());
+    ASSERT_TRUE(table3[ids[0]] != nullptr);
+    EXPECT_EQ("id0", table3[ids[0]]->value);
+
+    // Excluded and optional components are resolved per archetype
+    ids.emplace_back(database.createEntity());
+    table1.assign(ids[3], BoolComponent(false));
+
+    std::vector<std::pair<EntityId, bool>> filtered;
+
+    query(database)
+        .hasComponent<BoolComponent>()
+        .without<NumberComponent>()
+        .maybe<TextComponent>()
+        .execute([&](EntityId id, const BoolComponent&, const TextComponent* text)
+    {
+        filtered.emplace_back(id, text != nullptr);
+    });
+
+    EXPECT_THAT(filtered, testing::UnorderedElementsAre(
+        std::make_pair(ids[2], true),
+        std::make_pair(ids[3], false)));
+}
+
+TEST(Query, ChangedSinceFiltersWrittenComponents)
+{
+    for (auto backend : { StorageBackend::Tables, StorageBackend::Archetypes })
+    {
+        Database database(backend);
+
+        auto& table1 = database.createTable<NumberComponent>();
+        auto& table2 = database.createTable<BoolComponent>();
+
+        std::vector<EntityId> ids;
+        for (int i = 0; i < 4; ++i)
+        {
+            ids.emplace_back(database.createEntity());
+            table1.assign(ids.back(), NumberComponent(i));
+            table2.assign(ids.back(), BoolComponent(i % 2 == 0));
+        }
+
+        const uint32_t assigned = database.changeTick();
+        database.advanceChangeTick();
+
+        auto changedIds = [&](uint32_t tick)
+        {
+            return query(database)
+                .changedSince<NumberComponent>(tick)
+                .hasComponent<BoolComponent>()
+                .ids();
+        };
+
+        // All components were assigned before the current tick
+        EXPECT_EQ(4u, changedIds(0u).size());
+        EXPECT_TRUE(changedIds(assigned).empty());
+
+        // Executing a query over a mutable table stamps nothing by itself
+        query(database)
+            .hasComponent<NumberComponent>(table1)
+            .hasComponent<BoolComponent>()
+            .execute([&](EntityId, NumberComponent&, const BoolComponent&) {});
+
+        EXPECT_TRUE(changedIds(assigned).empty());
+
+        // Only the components which are marked written are stamped
+        query(database)
+            .hasComponent<NumberComponent>(table1)
+            .hasComponent<BoolComponent>()
+            .execute([&](EntityId id, NumberComponent& number, const BoolComponent& flag)
+        {
+            if (flag.value)
+            {
+                number.value += 10;
+                table1.markWritten(id);
+            }
+        });
+
+        EXPECT_THAT(changedIds(assigned), testing::UnorderedElementsAre(ids[0], ids[2]));
+
+        database.advanceChangeTick();
+        const uint32_t written = database.changeTick();
+
+        table1.markWritten(ids[3]);
+        database.advanceChangeTick();
+        table1.assign(ids[1], NumberComponent(100));
+
+        EXPECT_THAT(changedIds(written), testing::UnorderedElementsAre(ids[1]));
+        EXPECT_THAT(changedIds(written - 1u), testing::UnorderedElementsAre(ids[1], ids[3]));
+
+        // Writes of a changed query are stamped with the current tick
+        query(database)
+            .changedSince<NumberComponent>(written)
+            .hasComponent<NumberComponent>(table1)
+            .executeParallel([&](EntityId id, NumberComponent& number)
+        {
+            number.value = 0;
+            table1.markWritten(id);
+        });
+
+        EXPECT_EQ(0, table1[ids[1]]->value);
+        EXPECT_EQ(database.changeTick(), table1.writeTick(ids[1]));
+        EXPECT_TRUE(changedIds(database.changeTick()).empty());
+
+        // Persistent queries are moved to the tick of each update
+        PersistentQuery<
+            ChangedTable<ConstTableRef<NumberComponent>>,
+            ConstTableRef<BoolComponent>> changed;
+
+        changed = query(database)
+            .changedSince<NumberComponent>(0u)
+            .hasComponent<BoolComponent>();
+
+        std::vector<EntityId> executed;
+        auto collect = [&](EntityId id, const BoolComponent&)
+        {
+            executed.emplace_back(id);
+        };
+
+        changed->setChangedSince(written);
+        changed->execute(collect);
+        EXPECT_THAT(executed, testing::UnorderedElementsAre(ids[1]));
+
+        executed.clear();
+        changed->setChangedSince(database.changeTick());
+        changed->execute(collect);
+        for (EntityId id : *changed)
+        {
+            executed.emplace_back(id);
+        }
+        EXPECT_TRUE(executed.empty());
+
+        QueryCache cache;
+        changed->setChangedSince(written);
+        changed->executeIds(cache, [&](EntityId id)
+        {
+            executed.emplace_back(id);
+        });
+        EXPECT_THAT(executed, testing::UnorderedElementsAre(ids[1]));
+        EXPECT_EQ(4u, changed->ids(cache).size());
+    }
+}
+
+TEST(Query, ChangedSinceSeesWritesAfterConsumer)
+{
+    Database database;
+
+    auto& table = database.createTable<NumberComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 3; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table.assign(ids.back(), NumberComponent(i));
+    }
+    database.advanceChangeTick();
+
+    // Consumer records the tick it runs at, and sees changes since its previous run
+    uint32_t lastRun = 0u;
+    auto consume = [&]()
+    {
+        const uint32_t since = lastRun;
+        lastRun = database.changeTick();
+
+        std::vector<EntityId> changed;
+        query(database)
+            .changedSince<NumberComponent>(since)
+            .hasComponent<NumberComponent>(table)
+            .execute([&](EntityId id, NumberComponent& number)
+        {
+            changed.emplace_back(id);
+            if (id == ids[0])
+            {
+                number.value += 10;
+                table.markWritten(id);
+            }
+        });
+        database.advanceChangeTick();
+        return changed;
+    };
+
+    EXPECT_EQ(3u, consume().size());
+
+    // Writer updated after the consumer in the same frame
+    table.markWritten(ids[2]);
+    database.advanceChangeTick();
+
+    // Consumer sees the later write, but not its own
+    EXPECT_THAT(consume(), testing::ElementsAre(ids[2]));
+    EXPECT_TRUE(consume().empty());
+}
+
+TEST(Query, ChangedSinceMatchesAnyWrittenComponent)
+{
+    for (auto backend : { StorageBackend::Tables, StorageBackend::Archetypes })
+    {
+        Database database(backend);
+
+        auto& table1 = database.createTable<NumberComponent>();
+        auto& table2 = database.createTable<BoolComponent>();
+
+        std::vector<EntityId> ids;
+        for (int i = 0; i < 4; ++i)
+        {
+            ids.emplace_back(database.createEntity());
+            table1.assign(ids.back(), NumberComponent(i));
+            if (i < 3)
+            {
+                table2.assign(ids.back(), BoolComponent(true));
+            }
+        }
+
+        const uint32_t assigned = database.changeTick();
+        database.advanceChangeTick();
+
+        // Entities must have all components, of which any is written
+        table1.markWritten(ids[0]);
+        table2.markWritten(ids[1]);
+        table1.markWritten(ids[2]);
+        table2.markWritten(ids[2]);
+        table1.markWritten(ids[3]);
+
+        PersistentQuery<
+            ChangedTable<ConstTableRef<NumberComponent>, ConstTableRef<BoolComponent>>,
+            TableRef<NumberComponent>> changed;
+
+        changed = query(database)
+            .changedSince<NumberComponent, BoolComponent>(assigned)
+            .hasComponent<NumberComponent>(table1);
+
+        // Entities whose components both changed are executed once
+        std::vector<EntityId> executed;
+        changed->execute([&](EntityId id, NumberComponent& number)
+        {
+            executed.emplace_back(id);
+            number.value += 10;
+        });
+        EXPECT_THAT(executed, testing::UnorderedElementsAre(ids[0], ids[1], ids[2]));
+        EXPECT_EQ(12, table1[ids[2]]->value);
+
+        changed->setChangedSince(database.changeTick());
+        EXPECT_TRUE(changed->ids().empty());
+
+        QueryCache cache;
+        EXPECT_EQ(3u, changed->ids(cache).size());
+    }
+}
+
+TEST(Query, ArchetypeBackendMatchesTagsPerEntity)
+{
+    Database database(StorageBackend::Archetypes);
+
+    auto& table1 = database.createTable<NumberComponent>();
+    auto& table2 = database.createTable<TagComponent>();
+
+    std::vector<EntityId> ids;
+    for (int i = 0; i < 8; ++i)
+    {
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), NumberComponent(i));
+
+        if (i % 2 == 0)
+        {
+            table2.assign(ids.back(), TagComponent());
+        }
+    }
+
+    // Tags don't split archetypes, so matches are runs over a single chunk
+    std::vector<EntityId> tagged;
+    size_t chunkCount = 0u;
+
+    query(database)
+        .hasComponent<NumberComponent>(table1)
+        .hasComponent<TagComponent>()
+        .executeChunks([&](const QueryChunk& chunk, Span<NumberComponent> numbers)
+    {
+        ++chunkCount;
+        EXPECT_EQ(8u, chunk.size());
+        EXPECT_EQ(8u, numbers.size());
+
+        for (size_t i = 0; i < chunk.size(); ++i)
+        {
+            if (chunk.mask & (uint64_t(1) << i))
+            {
+                tagged.emplace_back(chunk.ids[i]);
+            }
+        }
+    });
+
+    EXPECT_EQ(1u, chunkCount);
+    EXPECT_EQ((std::vector<EntityId>{ ids[0], ids[2], ids[4], ids[6] }), tagged);
+
+    std::vector<EntityId> untagged;
+
+    query(database)
+        .hasComponent<NumberComponent>()
+        .without<TagComponent>()
+        .execute([&](EntityId id, const NumberComponent&)
+    {
+        untagged.emplace_back(id);
+    });
+
+    EXPECT_EQ((std::vector<EntityId>{ ids[1], ids[3], ids[5], ids[7] }), untagged);
+
+    std::vector<std::pair<EntityId, bool>> maybeTagged;
+
+    query(database)
+        .hasComponent<NumberComponent>()
+        .maybe<TagComponent>()
+        .execute([&](EntityId id, const NumberComponent&, const TagComponent* tag)
+    {
+        maybeTagged.emplace_back(id, tag != nullptr);
+    });
+
+    ASSERT_EQ(8u, maybeTagged.size());
+    EXPECT_EQ(std::make_pair(ids[0], true), maybeTagged[0]);
+    EXPECT_EQ(std::make_pair(ids[1], false), maybeTagged[1]);
+
+#ifndef NDEBUG
+    // Chunks are walked without planning a per-entity probe
+    auto tagQuery = query(database)
+        .hasComponent<NumberComponent>()
+        .hasComponent<TagComponent>();
+
+    size_t count = 0u;
+    tagQuery.execute([&](EntityId, const NumberComponent&, const TagComponent&)
+    {
+        ++count;
+    });
+
+    EXPECT_EQ(4u, count);
+    EXPECT_EQ(0u, tagQuery.stats().probes + tagQuery.stats().intersections);
+#endif
+}
+
+TEST(Query, PerformanceTest)
+{
+    Database database;
+
+    auto& table1 = database.createTable<BoolComponent>();
+    auto& table2 = database.createTable<NumberComponent>();
+    auto& table3 = database.createTable<TextComponent>();
+
+    size_t count = 2000u;
+
+    std::vector<EntityId> ids;
+    for (size_t i = 0; i < count; ++i)
+    { 
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), BoolComponent(true));
+        
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), BoolComponent(false));
+        table2.assign(ids.back(), NumberComponent(10));
+
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), BoolComponent(true));
+        table3.assign(ids.back(), TextComponent("text"));
+
+        ids.emplace_back(database.createEntity());
+        table2.assign(ids.back(), NumberComponent(100));
+        table3.assign(ids.back(), TextComponent("text"));
+
+        ids.emplace_back(database.createEntity());
+        table1.assign(ids.back(), BoolComponent(false));
+        table2.assign(ids.back(), NumberComponent(1000));
+        table3.assign(ids.back(), TextComponent("text"));
+    }
+    
+    size_t found = 0u;
+    Timer timer = Timer::start();
+
+    query(database)
+        .hasComponent<BoolComponent>()
+        .hasComponent<NumberComponent>()
+        .hasComponent<TextComponent>()
+        .execute([&](
+            EntityId id,
+            const BoolComponent& c1,
+            const NumberComponent& c2,
+            const TextComponent& c3) 
+    {
+        found++;
+    });
+
+    double elapsed = timer.reset();
+    EXPECT_EQ(found, count);
+
+    std::cout <<
+        "Entities: " << ids.size() << std::endl <<
+        "Matches:  " << found << std::endl <<
+        "Elapsed:  " << elapsed << " ms" << std::endl;
+}
+
+TEST(Query, PerformanceTestBackends)
+{
+    auto run = [](StorageBackend backend)
+    {
+        Database database(backend);
+
+        auto& table1 = database.createTable<BoolComponent>();
+        auto& table2 = database.createTable<NumberComponent>();
+        auto& table3 = database.createTable<TextComponent>();
+
+        size_t count = 20000u;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto id = database.createEntity();
+            table1.assign(id, BoolComponent(true));
+            table2.assign(id, NumberComponent(1));
+
+            id = database.createEntity();
+            table2.assign(id, NumberComponent(1));
+            table3.assign(id, TextComponent("text"));
+        }
+
+        size_t found = 0u;
+        Timer timer = Timer::start();
+
+        query(database)
+            .hasComponent<BoolComponent>()
+            .hasComponent<NumberComponent>()
+            .execute([&](
+                EntityId id,
+                const BoolComponent& c1,
+                const NumberComponent& c2)
+        {
+            found += c2.value;
+        });
+
+        double elapsed = timer.reset();
+        EXPECT_EQ(count, found);
+
+        return elapsed;
+    };
+
+    double elapsedTables = run(StorageBackend::Tables);
+    double elapsedArchetypes = run(StorageBackend::Archetypes);
+
+    std::cout <<
+        "Elapsed (tables):     " << elapsedTables << " ms" << std::endl <<
+        "Elapsed (archetypes): " << elapsedArchetypes << " ms" << std::endl;
+}
+
+TEST(Query, PerformanceTestCachedQuery)
+{
+    Database database;
+
+    auto& table1 = database.createTable<BoolComponent>();
+    auto& table2 = database.createTable<NumberComponent>();
+
+    size_t count = 20000u;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto id = database.createEntity();
+        table1.assign(id, BoolComponent(true));
+        table2.assign(id, NumberComponent(1));
+
+        id = database.createEntity();
+        table2.assign(id, NumberComponent(1));
+    }
+
+    database.sync();
+
+    // Repeat the same query as if executed once per frame
+    static constexpr size_t frames = 100u;
+
+    QueryCache cache;
+    size_t found = 0u;
+
+    auto run = [&](QueryCache* cached)
+    {
+        auto q = query(database)
+            .hasComponent<BoolComponent>()
+            .hasComponent<NumberComponent>();
+
+        auto process = [&](EntityId, const BoolComponent&, const NumberComponent& c2)
+        {
+            found += c2.value;
+        };
+
+        if (cached)
+        {
+            q.execute(*cached, process);
+        }
+        else
+        {
+            q.execute(process);
+        }
+    };
+
+    Timer timer = Timer::start();
+
+    for (size_t i = 0; i < frames; ++i)
+    {
+        run(nullptr);
+    }
+
+    double elapsedUncached = timer.reset();
+
+    for (size_t i = 0; i < frames; ++i)
+    {
+        run(&cache);
+    }
+
+    double elapsedCached = timer.reset();
+
+    EXPECT_EQ(2u * frames * count, found);
+    EXPECT_EQ(1u, cache.rebuildCount());
+
+    std::cout <<
+        "Frames:             " << frames << std::endl <<
+        "Elapsed (uncached): " << elapsedUncached << " ms" << std::endl <<
+        "Elapsed (cached):   " << elapsedCached << " ms" << std::endl;
+}
+
+TEST(Query, PerformanceTestParallel)
+{
+    Database database;
+
+    auto& table1 = database.createTable<BoolComponent>();
+    auto& table2 = database.createTable<NumberComponent>();
+
+    size_t count = 200000u;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto id = database.createEntity();
+        table1.assign(id, BoolComponent(true));
+        table2.assign(id, NumberComponent(static_cast<int>(i)));
+    }
+
+    // Enough arithmetic per entity to resemble bounds recomputation
+    auto work = [](const BoolComponent&, NumberComponent& number)
+    {
+        uint32_t value = static_cast<uint32_t>(number.value);
+        for (int i = 0; i < 64; ++i)
+        {
+            value = value * 1664525u + 1013904223u;
+        }
+        number.value = static_cast<int>(value >> 1);
+    };
+
+    auto q = query(database)
+        .hasComponent<BoolComponent>()
+        .hasComponent<NumberComponent>(table2);
+
+    Timer timer = Timer::start();
+
+    q.execute([&](EntityId, const BoolComponent& flag, NumberComponent& number)
+    {
+        work(flag, number);
+    });
+
+    double elapsedSerial = timer.reset();
+
+    q.executeParallel([&](EntityId, const BoolComponent& flag, NumberComponent& number)
+    {
+        work(flag, number);
+    });
+
+    double elapsedParallel = timer.reset();
+
+    std::cout <<
+        "Threads:            " << ThreadPool::shared().threadCount() << std::endl <<
+        "Elapsed (serial):   " << elapsedSerial << " ms" << std::endl <<
+        "Elapsed (parallel): " << elapsedParallel << " ms" << std::endl;
+}
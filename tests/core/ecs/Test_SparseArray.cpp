@@ -0,0 +1,99 @@
+#include <Precompiled.hpp>
+
+#include <core/Time.hpp>
+#include <core/ecs/SparseArray.hpp>
+
+#include <unordered_map>
+
+using namespace eng;
+
+TEST(SparseArray, SetAndGet)
+{
+    SparseArray array;
+    EXPECT_FALSE(array.check(100));
+    EXPECT_EQ(SparseArray::k_invalid, array.get(100));
+
+    array.set(100, 1);
+    array.set(5000, 2);
+    array.set(100, 3);
+
+    EXPECT_TRUE(array.check(100));
+    EXPECT_TRUE(array.check(5000));
+    EXPECT_FALSE(array.check(101));
+    EXPECT_EQ(3u, array.get(100));
+    EXPECT_EQ(2u, array.get(5000));
+}
+
+TEST(SparseArray, Erase)
+{
+    SparseArray array;
+    array.set(1, 10);
+    array.set(2, 20);
+
+    array.erase(1);
+    array.erase(1);
+    array.erase(123456);
+
+    EXPECT_FALSE(array.check(1));
+    EXPECT_EQ(20u, array.get(2));
+}
+
+TEST(SparseArray, PagesAreAllocatedOnDemandAndReleased)
+{
+    SparseArray array;
+    EXPECT_EQ(0u, array.pageCount());
+
+    // Ids spread far apart only allocate the pages they touch
+    array.set(1, 0);
+    array.set(1000000, 1);
+    array.set(2000000, 2);
+    EXPECT_EQ(3u, array.pageCount());
+
+    array.erase(1000000);
+    EXPECT_EQ(2u, array.pageCount());
+
+    array.clear();
+    EXPECT_EQ(0u, array.pageCount());
+    EXPECT_FALSE(array.check(2000000));
+}
+
+TEST(SparseArray, PerformanceTest)
+{
+    static constexpr uint32_t count = 200000u;
+
+    SparseArray array;
+    std::unordered_map<EntityId, uint32_t> map;
+
+    for (uint32_t i = 1u; i <= count; ++i)
+    {
+        array.set(i, i);
+        map[i] = i;
+    }
+
+    uint64_t sumArray = 0u;
+    uint64_t sumMap = 0u;
+
+    Timer timer = Timer::start();
+
+    for (uint32_t i = 1u; i <= count; ++i)
+    {
+        sumArray += array.get(i);
+    }
+
+    double elapsedArray = timer.reset();
+
+    for (uint32_t i = 1u; i <= count; ++i)
+    {
+        sumMap += map.find(i)->second;
+    }
+
+    double elapsedMap = timer.reset();
+
+    EXPECT_EQ(sumMap, sumArray);
+
+    std::cout <<
+        "Lookups:                 " << count << std::endl <<
+        "Pages:                   " << array.pageCount() << std::endl <<
+        "Elapsed (sparse array):  " << elapsedArray << " ms" << std::endl <<
+        "Elapsed (unordered_map): " << elapsedMap << " ms" << std::endl;
+}
@@ -1,9 +1,11 @@
 #include <Precompiled.hpp>
 
+#include <core/Simd.hpp>
 #include <core/Time.hpp>
 #include <core/ecs/SparseIndex.hpp>
 
 #include <array>
+#include <random>
 
 using namespace eng;
 using namespace testing;
@@ -25,6 +27,25 @@ TEST(SparseIndex, Insertion)
     EXPECT_TRUE(index.check(200));
 }
 
+TEST(SparseIndex, InsertRange)
+{
+    SparseIndex index;
+    index.insertRange(60, 10);
+    index.insertRange(128, 64);
+    index.insertRange(300, 0);
+
+    EXPECT_EQ(74u, index.size());
+    EXPECT_FALSE(index.check(59));
+    EXPECT_TRUE(index.check(60));
+    EXPECT_TRUE(index.check(69));
+    EXPECT_FALSE(index.check(70));
+    EXPECT_FALSE(index.check(127));
+    EXPECT_TRUE(index.check(128));
+    EXPECT_TRUE(index.check(191));
+    EXPECT_FALSE(index.check(192));
+    EXPECT_FALSE(index.check(300));
+}
+
 TEST(SparseIndex, Iteration)
 {
     SparseIndex index;
@@ -173,6 +194,235 @@ TEST(SparseIndex, BitwiseXor)
     EXPECT_TRUE(out2.check(300));
 }
 
+TEST(SparseIndex, Subtract)
+{
+    SparseIndex index;
+    index.insertRange(0, 5000);
+    index.insert(900000);
+
+    SparseIndex other;
+    other.insertRange(100, 4000);
+    other.insert(4500);
+
+    index.subtract(other);
+
+    EXPECT_EQ(1000u, index.size());
+    EXPECT_TRUE(index.check(99));
+    EXPECT_FALSE(index.check(100));
+    EXPECT_FALSE(index.check(4099));
+    EXPECT_TRUE(index.check(4100));
+    EXPECT_FALSE(index.check(4500));
+    EXPECT_TRUE(index.check(900000));
+
+    index.subtract(index);
+    EXPECT_TRUE(index.empty());
+}
+
+TEST(SparseIndex, BitwiseOperationsMatchAcrossInstructionSets)
+{
+    std::mt19937 random(3);
+    std::uniform_int_distribution<EntityId> sparseIds(0u, 2000000u);
+
+    // Dense regions take the bulk kernels, sparse ones the per-block path
+    SparseIndex in1;
+    SparseIndex in2;
+    in1.insertRange(1000, 300000);
+    in2.insertRange(150000, 400000);
+    for (int i = 0; i < 5000; ++i)
+    {
+        in1.erase(sparseIds(random) % 600000);
+        in2.erase(sparseIds(random) % 600000);
+        in1.insert(sparseIds(random));
+        in2.insert(sparseIds(random));
+    }
+
+    auto evaluate = [&]
+    {
+        SparseIndex outAnd = in1 & in2;
+        SparseIndex outOr = in1 | in2;
+        SparseIndex outXor = in1 ^ in2;
+        SparseIndex outSubtract = in1;
+        outSubtract.subtract(in2);
+
+        return std::vector<std::vector<EntityId>>
+        {
+            std::vector<EntityId>(outAnd.begin(), outAnd.end()),
+            std::vector<EntityId>(outOr.begin(), outOr.end()),
+            std::vector<EntityId>(outXor.begin(), outXor.end()),
+            std::vector<EntityId>(outSubtract.begin(), outSubtract.end()),
+            std::vector<EntityId>{ static_cast<EntityId>(outAnd.size()), static_cast<EntityId>(outOr.size()) }
+        };
+    };
+
+    const simd::InstructionSet supported = simd::supportedInstructionSet();
+
+    simd::setInstructionSet(simd::InstructionSet::Scalar);
+    auto expected = evaluate();
+
+    EXPECT_EQ(expected[0].size(), expected[4][0]);
+    EXPECT_EQ(expected[1].size(), expected[4][1]);
+
+    for (auto set : { simd::InstructionSet::SSE2, simd::InstructionSet::AVX2 })
+    {
+        simd::setInstructionSet(set);
+        EXPECT_EQ(expected, evaluate());
+    }
+
+    simd::setInstructionSet(supported);
+}
+
+TEST(SparseIndex, SizeIsMaintainedByAllOperations)
+{
+    std::mt19937 random(11);
+    std::uniform_int_distribution<EntityId> ids(0u, 300000u);
+
+    auto countIds = [](const SparseIndex& index)
+    {
+        return static_cast<size_t>(std::distance(index.begin(), index.end()));
+    };
+
+    SparseIndex index;
+    EXPECT_FALSE(index.any());
+
+    for (int round = 0; round < 20; ++round)
+    {
+        SparseIndex other;
+        other.insertRange(ids(random), 20000);
+        for (int i = 0; i < 1000; ++i)
+        {
+            index.insert(ids(random));
+            index.erase(ids(random));
+            other.insert(ids(random));
+        }
+        index.insertRange(ids(random), 5000);
+        EXPECT_EQ(countIds(index), index.size());
+        EXPECT_EQ(countIds(other), other.size());
+
+        switch (round % 4)
+        {
+            case 0: index |= other; break;
+            case 1: index &= other; break;
+            case 2: index ^= other; break;
+            case 3: index.subtract(other); break;
+        }
+
+        EXPECT_EQ(countIds(index), index.size());
+        EXPECT_EQ(index.size() != 0u, index.any());
+    }
+
+    index.clear();
+    EXPECT_EQ(0u, index.size());
+    EXPECT_FALSE(index.any());
+}
+
+TEST(SparseIndex, FusedIntersection)
+{
+    SparseIndex in1;
+    in1.insertRange(0, 10000);
+    in1.insert(50000);
+
+    SparseIndex in2;
+    in2.insertRange(5000, 10000);
+    in2.insert(50000);
+    in2.insert(90000);
+
+    SparseIndex in3;
+    for (EntityId id = 0; id < 100000; id += 3)
+    {
+        in3.insert(id);
+    }
+
+    const SparseIndex* indices[] = { &in1, &in2, &in3 };
+
+    std::vector<EntityId> ids;
+    SparseIndex::forEachIntersection(indices, 3, [&](EntityId id)
+    {
+        ids.emplace_back(id);
+    });
+
+    SparseIndex expected = in1 & in2 & in3;
+    EXPECT_EQ(std::vector<EntityId>(expected.begin(), expected.end()), ids);
+
+    SparseIndex fused = SparseIndex::intersection(indices, 3);
+    EXPECT_EQ(expected.size(), fused.size());
+    EXPECT_EQ(ids, std::vector<EntityId>(fused.begin(), fused.end()));
+
+    EXPECT_TRUE(SparseIndex::intersection(indices, 0).empty());
+    EXPECT_EQ(in2.size(), SparseIndex::intersection(indices + 1, 1).size());
+}
+
+TEST(SparseIndex, FusedIntersectionWithExclusion)
+{
+    SparseIndex in1;
+    in1.insertRange(0, 10000);
+    in1.insert(50000);
+
+    SparseIndex in2;
+    in2.insertRange(5000, 10000);
+    in2.insert(50000);
+
+    // Shorter than the intersection, so the tail is not masked
+    SparseIndex out1;
+    for (EntityId id = 0; id < 8000; id += 2)
+    {
+        out1.insert(id);
+    }
+
+    SparseIndex out2;
+    out2.insert(9999);
+    out2.insert(50000);
+
+    const SparseIndex* indices[] = { &in1, &in2 };
+    const SparseIndex* excluded[] = { &out1, &out2 };
+
+    std::vector<EntityId> ids;
+    SparseIndex::forEachIntersection(indices, 2, excluded, 2, [&](EntityId id)
+    {
+        ids.emplace_back(id);
+    });
+
+    SparseIndex expected = in1 & in2;
+    expected.subtract(out1);
+    expected.subtract(out2);
+    EXPECT_EQ(std::vector<EntityId>(expected.begin(), expected.end()), ids);
+
+    SparseIndex fused = SparseIndex::intersection(indices, 2, excluded, 2);
+    EXPECT_EQ(expected.size(), fused.size());
+    EXPECT_EQ(ids, std::vector<EntityId>(fused.begin(), fused.end()));
+}
+
+TEST(SparseIndex, SummaryTracksEmptyBlocks)
+{
+    SparseIndex index;
+    index.insert(10);
+    index.insert(5000);
+    index.insert(900000);
+
+    index.erase(5000);
+
+    std::vector<EntityId> ids(index.begin(), index.end());
+    EXPECT_EQ((std::vector<EntityId>{ 10, 900000 }), ids);
+
+    SparseIndex other;
+    other.insert(11);
+    other.insert(900000);
+
+    index &= other;
+
+    EXPECT_FALSE(index.empty());
+    EXPECT_EQ(1u, index.size());
+    EXPECT_EQ(900000u, *index.begin());
+
+    index ^= other;
+
+    EXPECT_EQ(std::vector<EntityId>{ 11 }, std::vector<EntityId>(index.begin(), index.end()));
+
+    index.erase(11);
+
+    EXPECT_TRUE(index.empty());
+    EXPECT_TRUE(index.begin() == index.end());
+}
+
 TEST(SparseIndex, PerformanceTest)
 {
     SparseIndex index;
@@ -214,3 +464,208 @@ TEST(SparseIndex, PerformanceTest)
         "Elapsed (insert): " << elapsedInsert << " ms" << std::endl <<
         "Elapsed (check):  " << elapsedCheck << " ms" << std::endl;
 }
+
+TEST(SparseIndex, PerformanceTestSparseIteration)
+{
+    static constexpr uint32_t matches = 1000u;
+    static constexpr uint32_t maxId = 1000000u;
+
+    SparseIndex dense;
+    SparseIndex sparse;
+
+    for (uint32_t i = 0u; i < matches; ++i)
+    {
+        dense.insert(i);
+        sparse.insert(i * (maxId / matches));
+    }
+
+    auto iterate = [](const SparseIndex& index)
+    {
+        size_t count = 0u;
+        for (auto it = index.begin(); it != index.end(); ++it)
+        {
+            ++count;
+        }
+        return count;
+    };
+
+    Timer timer = Timer::start();
+    size_t denseCount = iterate(dense);
+    double elapsedDense = timer.reset();
+    size_t sparseCount = iterate(sparse);
+    double elapsedSparse = timer.reset();
+
+    EXPECT_EQ(matches, denseCount);
+    EXPECT_EQ(matches, sparseCount);
+
+    std::cout <<
+        "Matches:          " << matches << std::endl <<
+        "Elapsed (dense):  " << elapsedDense << " ms, highest id " << (matches - 1) << std::endl <<
+        "Elapsed (sparse): " << elapsedSparse << " ms, highest id " << (maxId - maxId / matches) << std::endl;
+}
+
+TEST(SparseIndex, PerformanceTestSparseIntersection)
+{
+    static constexpr uint32_t maxId = 1000000u;
+
+    // A few tagged entities spread over a large id range
+    SparseIndex tags;
+    for (uint32_t id = 1000u; id < maxId; id += 100000u)
+    {
+        tags.insert(id);
+    }
+
+    SparseIndex components;
+    components.insertRange(0u, maxId);
+
+    Timer timer = Timer::start();
+
+    SparseIndex result = tags;
+    result &= components;
+
+    double elapsedAnd = timer.reset();
+
+    size_t count = 0u;
+    for (auto it = result.begin(); it != result.end(); ++it)
+    {
+        ++count;
+    }
+
+    double elapsedIterate = timer.reset();
+
+    bool empty = tags.empty();
+
+    double elapsedEmpty = timer.reset();
+
+    EXPECT_EQ(10u, count);
+    EXPECT_FALSE(empty);
+
+    std::cout <<
+        "Ids:               " << maxId << std::endl <<
+        "Matches:           " << count << std::endl <<
+        "Elapsed (and):     " << elapsedAnd << " ms" << std::endl <<
+        "Elapsed (iterate): " << elapsedIterate << " ms" << std::endl <<
+        "Elapsed (empty):   " << elapsedEmpty << " ms" << std::endl;
+}
+
+TEST(SparseIndex, PerformanceTestBulkKernels)
+{
+    static constexpr uint32_t maxId = 1u << 24;
+    static constexpr int rounds = 10;
+
+    std::mt19937 random(5);
+    std::uniform_int_distribution<uint32_t> ids(0u, maxId - 1);
+
+    // Two dense tables with a few holes
+    SparseIndex in1;
+    SparseIndex in2;
+    in1.insertRange(0u, maxId);
+    in2.insertRange(0u, maxId);
+    for (int i = 0; i < 100000; ++i)
+    {
+        in1.erase(ids(random));
+        in2.erase(ids(random));
+    }
+
+    const simd::InstructionSet supported = simd::supportedInstructionSet();
+
+    for (auto set : { simd::InstructionSet::Scalar, simd::InstructionSet::SSE2, simd::InstructionSet::AVX2 })
+    {
+        simd::setInstructionSet(set);
+        if (simd::instructionSet() != set)
+        {
+            continue;
+        }
+
+        SparseIndex out = in1;
+
+        Timer timer = Timer::start();
+
+        for (int i = 0; i < rounds; ++i)
+        {
+            out &= in2;
+        }
+
+        double elapsedAnd = timer.reset() / rounds;
+
+        for (int i = 0; i < rounds; ++i)
+        {
+            out |= in1;
+        }
+
+        double elapsedOr = timer.reset() / rounds;
+
+        size_t count = 0;
+        for (int i = 0; i < rounds; ++i)
+        {
+            count += out.size();
+        }
+
+        double elapsedSize = timer.reset() / rounds;
+
+        EXPECT_EQ(in1.size() * rounds, count);
+
+        const char* names[] = { "Scalar", "SSE2", "AVX2" };
+        std::cout <<
+            names[static_cast<int>(set)] << std::endl <<
+            "  Elapsed (and):  " << elapsedAnd << " ms" << std::endl <<
+            "  Elapsed (or):   " << elapsedOr << " ms" << std::endl <<
+            "  Elapsed (size): " << elapsedSize << " ms" << std::endl;
+    }
+
+    simd::setInstructionSet(supported);
+}
+
+TEST(SparseIndex, PerformanceTestFusedIntersection)
+{
+    static constexpr uint32_t maxId = 1000000u;
+    static constexpr int rounds = 100;
+
+    // Four tables of a typical system query, one of them small
+    std::array<SparseIndex, 4> tables;
+    tables[0].insertRange(0u, maxId);
+    tables[1].insertRange(100000u, maxId - 200000u);
+    tables[2].insertRange(0u, maxId / 2);
+    for (uint32_t id = 0u; id < maxId; id += 97u)
+    {
+        tables[3].insert(id);
+    }
+
+    const SparseIndex* indices[] = { &tables[3], &tables[0], &tables[1], &tables[2] };
+
+    Timer timer = Timer::start();
+
+    size_t chainedCount = 0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        SparseIndex index = tables[0];
+        index &= tables[1];
+        index &= tables[2];
+        index &= tables[3];
+
+        for (auto it = index.begin(); it != index.end(); ++it)
+        {
+            ++chainedCount;
+        }
+    }
+
+    double elapsedChained = timer.reset() / rounds;
+
+    size_t fusedCount = 0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        SparseIndex::forEachIntersection(indices, 4, [&](EntityId)
+        {
+            ++fusedCount;
+        });
+    }
+
+    double elapsedFused = timer.reset() / rounds;
+
+    EXPECT_EQ(chainedCount, fusedCount);
+
+    std::cout <<
+        "Matches:           " << fusedCount / rounds << std::endl <<
+        "Elapsed (chained): " << elapsedChained << " ms" << std::endl <<
+        "Elapsed (fused):   " << elapsedFused << " ms" << std::endl;
+}
@@ -0,0 +1,165 @@
+#include <Precompiled.hpp>
+
+#include <core/Time.hpp>
+#include <core/ecs/SparseIndex.hpp>
+#include <core/ecs/SparseSet.hpp>
+
+#include <random>
+
+using namespace eng;
+
+TEST(SparseSet, Insertion)
+{
+    SparseSet set;
+    EXPECT_TRUE(set.empty());
+    EXPECT_FALSE(set.any());
+
+    set.insert(100);
+    set.insert(100);
+    set.insert(5000000);
+    set.insertRange(10, 3);
+
+    EXPECT_EQ(5u, set.size());
+    EXPECT_TRUE(set.any());
+    EXPECT_TRUE(set.check(100));
+    EXPECT_TRUE(set.check(5000000));
+    EXPECT_TRUE(set.check(12));
+    EXPECT_FALSE(set.check(13));
+    EXPECT_FALSE(set.check(4999999));
+}
+
+TEST(SparseSet, IteratesInInsertionOrder)
+{
+    SparseSet set;
+    for (EntityId id : { 7u, 3u, 900u, 1u })
+    {
+        set.insert(id);
+    }
+
+    EXPECT_EQ((std::vector<EntityId>{ 7u, 3u, 900u, 1u }), std::vector<EntityId>(set.begin(), set.end()));
+
+    // Erasure swaps the last id into the erased position
+    set.erase(3u);
+    set.erase(3u);
+    set.erase(123456u);
+
+    EXPECT_EQ((std::vector<EntityId>{ 7u, 1u, 900u }), std::vector<EntityId>(set.begin(), set.end()));
+    EXPECT_FALSE(set.check(3u));
+    EXPECT_TRUE(set.check(1u));
+
+    set.erase(900u);
+    set.erase(7u);
+    set.erase(1u);
+
+    EXPECT_TRUE(set.empty());
+    EXPECT_TRUE(set.begin() == set.end());
+
+    set.insert(3u);
+    set.clear();
+    EXPECT_FALSE(set.check(3u));
+    EXPECT_EQ(0u, set.size());
+}
+
+TEST(SparseSet, PerformanceTestAgainstSparseIndex)
+{
+    static constexpr uint32_t maxId = 1u << 20;
+
+    std::mt19937 random(9);
+
+    for (double density : { 0.001, 0.01, 0.1, 0.5 })
+    {
+        const size_t count = static_cast<size_t>(maxId * density);
+
+        std::uniform_int_distribution<uint32_t> ids(0u, maxId - 1);
+        std::vector<EntityId> values1(count);
+        std::vector<EntityId> values2(count);
+        std::generate(values1.begin(), values1.end(), [&] { return ids(random); });
+        std::generate(values2.begin(), values2.end(), [&] { return ids(random); });
+
+        auto measure = [&](auto index, const char* name)
+        {
+            using Index = decltype(index);
+
+            Timer timer = Timer::start();
+
+            Index in1;
+            Index in2;
+            for (auto id : values1)
+            {
+                in1.insert(id);
+            }
+            for (auto id : values2)
+            {
+                in2.insert(id);
+            }
+
+            double elapsedInsert = timer.reset();
+
+            size_t iterated = 0;
+            for (auto id : in1)
+            {
+                iterated += id & 1u;
+            }
+
+            double elapsedIterate = timer.reset();
+
+            // Probe the other index for each id, which works for both containers
+            size_t matches = 0;
+            for (auto id : in1)
+            {
+                matches += in2.check(id) ? 1u : 0u;
+            }
+
+            double elapsedIntersect = timer.reset();
+
+            for (size_t i = 0; i < count; i += 2)
+            {
+                in1.erase(values1[i]);
+            }
+
+            double elapsedErase = timer.reset();
+
+            std::cout <<
+                "  " << name << std::endl <<
+                "    Bytes:              " << in2.memoryUsage() << std::endl <<
+                "    Elapsed (insert):   " << elapsedInsert << " ms" << std::endl <<
+                "    Elapsed (iterate):  " << elapsedIterate << " ms" << std::endl <<
+                "    Elapsed (intersect):" << elapsedIntersect << " ms" << std::endl <<
+                "    Elapsed (erase):    " << elapsedErase << " ms" << std::endl;
+
+            return std::make_pair(matches, iterated);
+        };
+
+        std::cout << "Density " << density << ", ids " << count << std::endl;
+
+        auto sparseIndex = measure(SparseIndex(), "SparseIndex");
+        auto sparseSet = measure(SparseSet(), "SparseSet");
+
+        // Fused bitset intersection for reference
+        SparseIndex in1;
+        SparseIndex in2;
+        for (auto id : values1)
+        {
+            in1.insert(id);
+        }
+        for (auto id : values2)
+        {
+            in2.insert(id);
+        }
+
+        const SparseIndex* indices[] = { &in1, &in2 };
+
+        Timer timer = Timer::start();
+
+        size_t fusedMatches = 0;
+        SparseIndex::forEachIntersection(indices, 2, [&](EntityId)
+        {
+            ++fusedMatches;
+        });
+
+        std::cout << "  SparseIndex fused intersect: " << timer.elapsed() << " ms" << std::endl;
+
+        EXPECT_EQ(sparseIndex, sparseSet);
+        EXPECT_EQ(sparseIndex.first, fusedMatches);
+    }
+}
@@ -1,8 +1,11 @@
 #include <Precompiled.hpp>
 
+#include <core/Time.hpp>
 #include <core/ecs/Table.hpp>
 #include <core/ecs/TestComponents.hpp>
 
+#include <random>
+
 using namespace eng;
 
 TEST(Table, Assign)
@@ -33,3 +36,426 @@ TEST(Table, Remove)
     EXPECT_EQ(0u, table.size());
     EXPECT_FALSE(table[id] != nullptr);
 }
+
+TEST(Table, RemoveKeepsOtherComponents)
+{
+    Table<NumberComponent> table;
+
+    table.assign(1u, NumberComponent(1));
+    table.assign(2u, NumberComponent(2));
+    table.assign(3u, NumberComponent(3));
+
+    table.remove(1u);
+
+    EXPECT_EQ(2u, table.size());
+    EXPECT_TRUE(table[1u] == nullptr);
+    ASSERT_TRUE(table[2u] != nullptr);
+    EXPECT_EQ(2, table[2u]->value);
+    ASSERT_TRUE(table[3u] != nullptr);
+    EXPECT_EQ(3, table[3u]->value);
+}
+
+TEST(Table, AssignOverwritesExistingComponent)
+{
+    Table<NumberComponent> table;
+
+    table.assign(5u, NumberComponent(1));
+    table.assign(5u, NumberComponent(2));
+
+    EXPECT_EQ(1u, table.size());
+    ASSERT_TRUE(table[5u] != nullptr);
+    EXPECT_EQ(2, table[5u]->value);
+}
+
+TEST(Table, ForEachSkipsRemovedComponents)
+{
+    Table<NumberComponent> table;
+
+    for (EntityId id = 1u; id <= 5u; ++id)
+    {
+        table.assign(id, NumberComponent(static_cast<int>(id) * 10));
+    }
+
+    table.remove(2u);
+    table.remove(4u);
+
+    std::vector<std::pair<EntityId, int>> results;
+    table.forEach([&](EntityId id, NumberComponent& c)
+    {
+        results.emplace_back(id, c.value);
+    });
+
+    EXPECT_THAT(results, testing::UnorderedElementsAre(
+        std::make_pair(1u, 10),
+        std::make_pair(3u, 30),
+        std::make_pair(5u, 50)));
+}
+
+TEST(Table, AssignBatch)
+{
+    Table<NumberComponent> table;
+
+    table.assign(62u, NumberComponent(-1));
+
+    std::vector<NumberComponent> components;
+    for (int i = 0; i < 100; ++i)
+    {
+        components.emplace_back(i);
+    }
+
+    table.assignBatch(EntityRange(50u, 100u), Span<NumberComponent>(components.data(), components.size()));
+
+    EXPECT_EQ(100u, table.size());
+    EXPECT_FALSE(table.check(49u));
+    EXPECT_FALSE(table.check(150u));
+    ASSERT_TRUE(table[50u] != nullptr);
+    EXPECT_EQ(0, table[50u]->value);
+    ASSERT_TRUE(table[62u] != nullptr);
+    EXPECT_EQ(12, table[62u]->value);
+    ASSERT_TRUE(table[149u] != nullptr);
+    EXPECT_EQ(99, table[149u]->value);
+
+    std::vector<EntityId> ids = { 7u, 300u };
+    std::vector<NumberComponent> more = { NumberComponent(7), NumberComponent(300) };
+
+    table.assignBatch(Span<const EntityId>(ids.data(), ids.size()), Span<NumberComponent>(more.data(), more.size()));
+
+    EXPECT_EQ(102u, table.size());
+    EXPECT_EQ(7, table[7u]->value);
+    EXPECT_EQ(300, table[300u]->value);
+}
+
+TEST(Table, SpansMatchForEachOrder)
+{
+    Table<NumberComponent> table;
+
+    for (EntityId id = 1u; id <= 4u; ++id)
+    {
+        table.assign(id, NumberComponent(static_cast<int>(id)));
+    }
+
+    table.remove(1u);
+
+    for (auto& c : table.components())
+    {
+        c.value *= 10;
+    }
+
+    std::vector<std::pair<EntityId, int>> fromSpans;
+    for (size_t i = 0; i < table.ids().size(); ++i)
+    {
+        fromSpans.emplace_back(table.ids()[i], table.components()[i].value);
+    }
+
+    std::vector<std::pair<EntityId, int>> fromForEach;
+    const auto& constTable = table;
+    constTable.forEach([&](EntityId id, const NumberComponent& c)
+    {
+        fromForEach.emplace_back(id, c.value);
+    });
+
+    EXPECT_EQ(fromSpans, fromForEach);
+    EXPECT_THAT(fromSpans, testing::UnorderedElementsAre(
+        std::make_pair(2u, 20),
+        std::make_pair(3u, 30),
+        std::make_pair(4u, 40)));
+}
+
+TEST(Table, PerformanceTestForEach)
+{
+    static constexpr uint32_t count = 1000000u;
+
+    Table<NumberComponent> table;
+
+    for (uint32_t i = 1u; i <= count; ++i)
+    {
+        table.assign(i, NumberComponent(1));
+    }
+
+    int64_t sumFunction = 0;
+    int64_t sumTemplate = 0;
+    int64_t sumSpan = 0;
+
+    // Indirect call per entity, as with the former std::function parameter
+    std::function<void(EntityId, NumberComponent&)> function = 
+        [&](EntityId, NumberComponent& c) { sumFunction += c.value; };
+
+    Timer timer = Timer::start();
+
+    auto ids = table.ids();
+    auto components = table.components();
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        function(ids[i], components[i]);
+    }
+
+    double elapsedFunction = timer.reset();
+
+    table.forEach([&](EntityId, NumberComponent& c)
+    {
+        sumTemplate += c.value;
+    });
+
+    double elapsedTemplate = timer.reset();
+
+    for (auto& c : table.components())
+    {
+        sumSpan += c.value;
+    }
+
+    double elapsedSpan = timer.reset();
+
+    EXPECT_EQ(count, sumFunction);
+    EXPECT_EQ(count, sumTemplate);
+    EXPECT_EQ(count, sumSpan);
+
+    auto perEntity = [](double ms) { return ms * 1e6 / count; };
+
+    std::cout <<
+        "Entities:                   " << count << std::endl <<
+        "Elapsed (std::function):    " << elapsedFunction << " ms, " << 
+            perEntity(elapsedFunction) << " ns/entity" << std::endl <<
+        "Elapsed (template forEach): " << elapsedTemplate << " ms, " << 
+            perEntity(elapsedTemplate) << " ns/entity" << std::endl <<
+        "Elapsed (span):             " << elapsedSpan << " ms, " << 
+            perEntity(elapsedSpan) << " ns/entity" << std::endl;
+}
+
+TEST(Table, CompactSortsComponentsIntoIdOrder)
+{
+    Table<NumberComponent> table;
+
+    for (EntityId id : { 9u, 3u, 7u, 1u, 5u, 8u, 2u })
+    {
+        table.assign(id, NumberComponent(static_cast<int>(id)));
+    }
+    table.remove(7u);
+
+    Timer timer = Timer::start();
+    auto stats = table.compact(timer, 1000.0);
+
+    EXPECT_GT(stats.moved, 0u);
+    EXPECT_EQ(0u, stats.remaining);
+
+    std::vector<EntityId> ids(table.ids().begin(), table.ids().end());
+    EXPECT_EQ((std::vector<EntityId>{ 1u, 2u, 3u, 5u, 8u, 9u }), ids);
+
+    for (auto id : ids)
+    {
+        ASSERT_TRUE(table[id] != nullptr);
+        EXPECT_EQ(static_cast<int>(id), table[id]->value);
+    }
+
+    stats = table.compact(timer, 1000.0);
+    EXPECT_EQ(0u, stats.moved);
+
+    // Structural changes shrink the compacted range
+    table.assign(4u, NumberComponent(4));
+    table.remove(2u);
+
+    stats = table.compact(timer, 1000.0);
+    EXPECT_EQ(0u, stats.remaining);
+
+    ids.assign(table.ids().begin(), table.ids().end());
+    EXPECT_EQ((std::vector<EntityId>{ 1u, 3u, 4u, 5u, 8u, 9u }), ids);
+    EXPECT_EQ(4, table[4u]->value);
+}
+
+TEST(Table, ContiguousPositionOfCompactedRanges)
+{
+    Table<NumberComponent> table;
+
+    // Components appended in entity order need no compaction
+    for (EntityId id = 10u; id < 20u; ++id)
+    {
+        table.assign(id, NumberComponent(static_cast<int>(id)));
+    }
+
+    EXPECT_EQ(0u, table.contiguousPosition(10u, 10u));
+    EXPECT_EQ(3u, table.contiguousPosition(13u, 5u));
+    EXPECT_EQ(SparseArray::k_invalid, table.contiguousPosition(13u, 8u));
+    EXPECT_EQ(SparseArray::k_invalid, table.contiguousPosition(5u, 1u));
+
+    // Swap removal breaks the order from the removed slot onwards
+    table.remove(12u);
+
+    EXPECT_EQ(0u, table.contiguousPosition(10u, 2u));
+    EXPECT_EQ(SparseArray::k_invalid, table.contiguousPosition(13u, 3u));
+    EXPECT_EQ(2u, table.contiguousPosition(19u, 1u));
+
+    Timer timer = Timer::start();
+    table.compact(timer, 1000.0);
+
+    EXPECT_EQ(2u, table.contiguousPosition(13u, 7u));
+    EXPECT_EQ(SparseArray::k_invalid, table.contiguousPosition(11u, 2u));
+}
+
+TEST(Table, SparseSetIndexKeepsComponentOrder)
+{
+    Table<SparseSetComponent> table;
+    static_assert(std::is_same<Table<SparseSetComponent>::IndexType, SparseSet>::value,
+        "Component should select sparse set index");
+
+    for (EntityId id : { 900000u, 3u, 70000u, 1u, 5u })
+    {
+        table.assign(id, SparseSetComponent(static_cast<int>(id)));
+    }
+    table.remove(3u);
+    table.assign(1u, SparseSetComponent(10));
+
+    EXPECT_EQ(4u, table.size());
+    EXPECT_FALSE(table.check(3u));
+    EXPECT_TRUE(table.check(900000u));
+    EXPECT_EQ(10, table[1u]->value);
+
+    // Index iterates in the same order as the packed components
+    std::vector<EntityId> indexOrder(table.index().begin(), table.index().end());
+    std::vector<EntityId> ids(table.ids().begin(), table.ids().end());
+    EXPECT_EQ(ids, indexOrder);
+
+    Timer timer = Timer::start();
+    auto stats = table.compact(timer, 1000.0);
+    EXPECT_EQ(0u, stats.moved);
+    EXPECT_EQ(0u, stats.remaining);
+
+    table.clear();
+    EXPECT_TRUE(table.empty());
+    EXPECT_TRUE(table.index().empty());
+}
+
+TEST(Table, CompactStopsWhenOutOfBudget)
+{
+    Table<NumberComponent> table;
+
+    for (EntityId id = 10u; id > 0u; --id)
+    {
+        table.assign(id, NumberComponent(static_cast<int>(id)));
+    }
+
+    Timer timer = Timer::start();
+    auto stats = table.compact(timer, 0.0);
+
+    EXPECT_EQ(0u, stats.moved);
+    EXPECT_EQ(10u, stats.remaining);
+}
+
+TEST(Table, PerformanceTestCompaction)
+{
+    static constexpr uint32_t count = 200000u;
+
+    Table<NumberComponent> table;
+
+    std::vector<EntityId> ids;
+    for (uint32_t i = 1u; i <= count; ++i)
+    {
+        ids.emplace_back(i);
+    }
+    std::shuffle(ids.begin(), ids.end(), std::mt19937(1234u));
+
+    for (auto id : ids)
+    {
+        table.assign(id, NumberComponent(1));
+    }
+
+    // Visit components in id order, as queries do
+    auto visit = [&]()
+    {
+        int64_t sum = 0;
+        for (auto id : table.index())
+        {
+            sum += table[id]->value;
+        }
+        return sum;
+    };
+
+    Timer timer = Timer::start();
+    int64_t sumBefore = visit();
+    double elapsedBefore = timer.reset();
+
+    auto stats = table.compact(timer, 1000.0);
+    double elapsedCompact = timer.reset();
+
+    int64_t sumAfter = visit();
+    double elapsedAfter = timer.reset();
+
+    EXPECT_EQ(count, sumBefore);
+    EXPECT_EQ(count, sumAfter);
+    EXPECT_EQ(0u, stats.remaining);
+
+    std::cout <<
+        "Components:        " << count << std::endl <<
+        "Moved:             " << stats.moved << std::endl <<
+        "Elapsed (before):  " << elapsedBefore << " ms" << std::endl <<
+        "Elapsed (compact): " << elapsedCompact << " ms" << std::endl <<
+        "Elapsed (after):   " << elapsedAfter << " ms" << std::endl;
+}
+
+TEST(Table, StructuralVersionChangesOnlyWithMembership)
+{
+    Table<NumberComponent> table;
+    uint64_t version = table.structuralVersion();
+
+    table.assign(1u, NumberComponent(1));
+    EXPECT_NE(version, table.structuralVersion());
+    version = table.structuralVersion();
+
+    // Overwriting a component and removing a missing one are not structural
+    table.assign(1u, NumberComponent(2));
+    table.remove(2u);
+    EXPECT_EQ(version, table.structuralVersion());
+
+    table.remove(1u);
+    EXPECT_NE(version, table.structuralVersion());
+    version = table.structuralVersion();
+
+    table.clear();
+    EXPECT_EQ(version, table.structuralVersion());
+
+    Table<TagComponent> tags;
+    version = tags.structuralVersion();
+
+    tags.assign(3u, TagComponent());
+    tags.assign(3u, TagComponent());
+    EXPECT_EQ(version + 1u, tags.structuralVersion());
+
+    tags.clear();
+    EXPECT_EQ(version + 2u, tags.structuralVersion());
+}
+
+TEST(Table, TagTableStoresOnlyIndex)
+{
+    Table<TagComponent> table;
+
+    table.assign(10u, TagComponent());
+    table.assign(20u, TagComponent());
+
+    EXPECT_EQ(2u, table.size());
+    EXPECT_TRUE(table.check(10u));
+    EXPECT_TRUE(table[20u] != nullptr);
+    EXPECT_TRUE(table[30u] == nullptr);
+    EXPECT_EQ((std::vector<EntityId>{ 10u, 20u }), table.ids());
+
+    table.remove(10u);
+
+    EXPECT_FALSE(table.check(10u));
+    EXPECT_EQ(1u, table.size());
+}
+
+TEST(Table, TagTableAssignsAndClearsInBulk)
+{
+    Table<TagComponent> source;
+    Table<TagComponent> target;
+
+    source.assign(1u, TagComponent());
+    source.assign(70u, TagComponent());
+    target.assign(5u, TagComponent());
+
+    target.assign(source.index());
+
+    EXPECT_EQ((std::vector<EntityId>{ 1u, 5u, 70u }), target.ids());
+
+    target.clear();
+
+    EXPECT_TRUE(target.empty());
+    EXPECT_FALSE(target.check(70u));
+}